@@ -1,73 +1,1228 @@
-#include <sstream>
-#include <iterator>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #include "ClicDb.h"
 #include "types.h"
 #include "clic_printer.h"
-#include "clic_parser.h"
 
-ClicDb::ClicDb(const char* dbFilename) : db(NULL, 0)
+namespace {
+
+void encodeId(uint32_t id, unsigned char (&buf)[4]) {
+    // Big endian so the ids sort numerically as keys
+    buf[0] = id >> 24;
+    buf[1] = id >> 16;
+    buf[2] = id >> 8;
+    buf[3] = id;
+}
+
+uint32_t decodeId(const void* data) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint32_t decodeId(const Dbt& dbt) {
+    return decodeId(dbt.get_data());
+}
+
+// Substring searches look names up by every run of this many bytes
+const size_t nameGramSize = 3;
+
+std::set<std::string> gramsOf(StringRef name) {
+    std::set<std::string> grams;
+    for (size_t i = 0; i + nameGramSize <= name.size; ++i)
+        grams.insert(std::string(name.data + i, nameGramSize));
+    return grams;
+}
+
+uint64_t decodeHash(const Dbt& dbt) {
+    const unsigned char* p = static_cast<const unsigned char*>(dbt.get_data());
+    uint64_t hash = 0;
+    for (unsigned i = 0; i != dbt.get_size(); ++i)
+        hash = (hash << 8) | p[i];
+    return hash;
+}
+
+} // namespace
+
+ClicDb::ClicDb(const char* dbFilename, const ClicDbOptions& options)
+    : transactional(options.transactional), txn(NULL),
+      env(0), meta(&env, 0), contributions(&env, 0), refCounts(&env, 0),
+      files(&env, 0), fileNames(&env, 0), usrIds(&env, 0), usrStrings(&env, 0),
+      manifest(&env, 0), includes(&env, 0), includedBy(&env, 0), headers(&env, 0),
+      names(&env, 0), nameGrams(&env, 0), usrNames(&env, 0)
 {
+    dbFilenames.push_back(dbFilename);
+
     try {
-        db.set_error_stream(&std::cerr);
-        db.open(NULL, dbFilename, NULL, DB_BTREE, DB_CREATE, 0);
+        env.set_error_stream(&std::cerr);
+        if (options.cacheSizeMb)
+            env.set_cachesize(options.cacheSizeMb / 1024, (options.cacheSizeMb % 1024) << 20, 1);
+
+        u_int32_t openFlags = DB_CREATE;
+        if (transactional) {
+            // The environment lives next to index.db, so every process
+            // opening the same file shares its locks and log. DB_REGISTER
+            // runs recovery only when a previous user died without closing
+            // it.
+            std::string path(dbFilename);
+            std::string::size_type slash = path.rfind('/');
+            std::string home = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+            dbFilename += slash == std::string::npos ? 0 : slash + 1;
+
+            // One transaction covers a whole translation unit, which can
+            // lock many pages.
+            env.set_lk_max_locks(100000);
+            env.set_lk_max_objects(100000);
+            env.set_lk_detect(DB_LOCK_DEFAULT);
+            env.log_set_config(DB_LOG_AUTO_REMOVE, 1);
+            env.open(home.c_str(), DB_CREATE | DB_INIT_LOCK | DB_INIT_LOG | DB_INIT_MPOOL
+                     | DB_INIT_TXN | DB_RECOVER | DB_REGISTER, 0);
+            openFlags |= DB_AUTO_COMMIT;
+        } else {
+            // A private environment only provides the shared cache that is
+            // needed to keep several databases in one file.
+            env.open(NULL, DB_CREATE | DB_INIT_MPOOL | DB_PRIVATE, 0);
+        }
+
+        meta.open(NULL, dbFilename, "meta", DB_BTREE, openFlags, 0);
+        // Writing a database in the other kind of environment than it was
+        // created in corrupts it: without the locks and log of the
+        // transactional one, writers run into each other and recovery
+        // misses what was written. The kind is kept from the first open on.
+        Dbt txnKey(const_cast<char*>("txn"), 3);
+        Dbt txnValue;
+        if (meta.get(NULL, &txnKey, &txnValue, 0) != DB_NOTFOUND) {
+            bool created = txnValue.get_size() == 1
+                && *static_cast<const char*>(txnValue.get_data()) == '1';
+            if (created != transactional) {
+                std::cerr << "ERROR: `" << dbFilenames.front() << "' was created "
+                          << (created ? "with" : "without") << " --txn.\n";
+                exit(1);
+            }
+        } else {
+            txnValue = Dbt(const_cast<char*>(transactional ? "1" : "0"), 1);
+            meta.put(NULL, &txnKey, &txnValue, 0);
+        }
+        contributions.set_flags(DB_DUPSORT);
+        contributions.open(NULL, dbFilename, "contributions", DB_BTREE, openFlags, 0);
+        refCounts.open(NULL, dbFilename, "refcounts", DB_BTREE, openFlags, 0);
+        files.open(NULL, dbFilename, "files", DB_BTREE, openFlags, 0);
+        fileNames.open(NULL, dbFilename, "filenames", DB_BTREE, openFlags, 0);
+        usrIds.open(NULL, dbFilename, "usrids", DB_BTREE, openFlags, 0);
+        usrStrings.open(NULL, dbFilename, "usrs", DB_BTREE, openFlags, 0);
+        manifest.open(NULL, dbFilename, "manifest", DB_BTREE, openFlags, 0);
+        includes.set_flags(DB_DUPSORT);
+        includes.open(NULL, dbFilename, "includes", DB_BTREE, openFlags, 0);
+        includedBy.set_flags(DB_DUPSORT);
+        includedBy.open(NULL, dbFilename, "includedby", DB_BTREE, openFlags, 0);
+        headers.open(NULL, dbFilename, "headers", DB_BTREE, openFlags, 0);
+        names.set_flags(DB_DUPSORT);
+        names.open(NULL, dbFilename, "names", DB_BTREE, openFlags, 0);
+        nameGrams.set_flags(DB_DUPSORT);
+        nameGrams.open(NULL, dbFilename, "namegrams", DB_BTREE, openFlags, 0);
+        usrNames.open(NULL, dbFilename, "usrnames", DB_BTREE, openFlags, 0);
+
+        // The shard count is fixed when the database is created. Databases
+        // from before the meta table have their references in index.db.
+        unsigned shardCount = options.shards ? options.shards : 1;
+        Dbt key(const_cast<char*>("shards"), 6);
+        Dbt value, last;
+        bool stored = meta.get(NULL, &key, &value, 0) != DB_NOTFOUND;
+        if (stored) {
+            shardCount = std::stoul(std::string(static_cast<const char*>(value.get_data()),
+                                                value.get_size()));
+        } else {
+            ClicCursor cursor(fileNames, NULL);
+            if (cursor->get(&last, &value, DB_LAST) != DB_NOTFOUND)
+                shardCount = 1;
+        }
+        if (options.shards && options.shards != shardCount) {
+            std::cerr << "ERROR: `" << dbFilenames.front() << "' has " << shardCount << " shards.\n";
+            exit(1);
+        }
+        if (!stored) {
+            std::string count = std::to_string(shardCount);
+            Dbt countDbt(const_cast<char*>(count.c_str()), count.size());
+            meta.put(NULL, &key, &countDbt, 0);
+        }
+
+        for (unsigned i = 0; i != shardCount; ++i) {
+            std::string shardFilename(dbFilename);
+            if (shardCount != 1) {
+                shardFilename += "." + std::to_string(i);
+                dbFilenames.push_back(dbFilenames.front() + "." + std::to_string(i));
+            }
+            shards.emplace_back(new Db(&env, 0));
+            shards.back()->set_flags(DB_DUPSORT);
+            shards.back()->open(NULL, shardFilename.c_str(), "refs", DB_BTREE, openFlags, 0);
+        }
     } catch(DbException &e) {
         std::cerr << "Exception thrown: " << e.what() << std::endl;
         exit(1);
     }
+
+    // Databases from before namegrams get it filled once
+    transaction([&]() {
+        Dbt key(const_cast<char*>("namegrams"), 9);
+        Dbt value;
+        if (meta.get(txn, &key, &value, 0) != DB_NOTFOUND)
+            return;
+        {
+            ClicCursor cursor(names, txn);
+            Dbt name, entry;
+            while (cursor->get(&name, &entry, DB_NEXT_NODUP) != DB_NOTFOUND)
+                addNameGrams(StringRef(static_cast<const char*>(name.get_data()),
+                                       name.get_size()));
+        }
+        Dbt done(const_cast<char*>("1"), 1);
+        meta.put(txn, &key, &done, 0);
+    });
 }
 
 ClicDb::~ClicDb() {
-    db.close(0);
+    usrNames.close(0);
+    nameGrams.close(0);
+    names.close(0);
+    headers.close(0);
+    includedBy.close(0);
+    includes.close(0);
+    manifest.close(0);
+    usrStrings.close(0);
+    usrIds.close(0);
+    fileNames.close(0);
+    files.close(0);
+    refCounts.close(0);
+    contributions.close(0);
+    meta.close(0);
+    for (auto &shard : shards)
+        shard->close(0);
+    if (transactional)
+        env.txn_checkpoint(0, 0, 0);
+    env.close(0);
+}
+
+void ClicDb::transaction(const std::function<void()>& body) {
+    runTransaction(body, 0);
+}
+
+void ClicDb::runTransaction(const std::function<void()>& body, u_int32_t txnFlags) {
+    // Nested calls join the transaction that is already running
+    if (txn) {
+        body();
+        return;
+    }
+
+    try {
+        for (;;) {
+            if (transactional)
+                env.txn_begin(NULL, &txn, txnFlags);
+            try {
+                body();
+                if (txn)
+                    txn->commit(0);
+                txn = NULL;
+                return;
+            } catch(DbDeadlockException &) {
+                txn->abort();
+                txn = NULL;
+                // Ids handed out by the aborted transaction do not exist
+                forgetFiles();
+            }
+        }
+    } catch(DbException &e) {
+        std::cerr << "Exception thrown: " << e.what() << std::endl;
+        exit(1);
+    }
 }
 
 void ClicDb::clear() {
+    transaction([&]() {
+        for (auto &shard : shards)
+            shard->truncate(txn, 0, 0);
+        contributions.truncate(txn, 0, 0);
+        refCounts.truncate(txn, 0, 0);
+        files.truncate(txn, 0, 0);
+        fileNames.truncate(txn, 0, 0);
+        usrIds.truncate(txn, 0, 0);
+        usrStrings.truncate(txn, 0, 0);
+        manifest.truncate(txn, 0, 0);
+        includes.truncate(txn, 0, 0);
+        includedBy.truncate(txn, 0, 0);
+        headers.truncate(txn, 0, 0);
+        names.truncate(txn, 0, 0);
+        nameGrams.truncate(txn, 0, 0);
+        usrNames.truncate(txn, 0, 0);
+        forgetFiles();
+    });
+}
+
+void ClicDb::setBuilding(bool building) {
+    Dbt key(const_cast<char*>("building"), 8);
+    transaction([&]() {
+        if (building) {
+            Dbt value(const_cast<char*>("1"), 1);
+            meta.put(txn, &key, &value, 0);
+        } else {
+            meta.del(txn, &key, 0);
+        }
+    });
+}
+
+bool ClicDb::building() {
+    bool found = false;
+    transaction([&]() {
+        Dbt key(const_cast<char*>("building"), 8);
+        Dbt value;
+        found = meta.get(txn, &key, &value, 0) != DB_NOTFOUND;
+    });
+    return found;
+}
+
+size_t ClicDb::shardOf(const char* usr, size_t size) const {
+    return shards.size() == 1 ? 0 : hashBytes(usr, size) % shards.size();
+}
+
+void ClicDb::syncShards() {
+    for (auto &shard : shards)
+        shard->sync(0);
+}
+
+size_t ClicDb::compact(unsigned fillPercent) {
+    std::vector<Db*> tables = {&meta, &contributions, &refCounts, &files, &fileNames,
+                               &usrIds, &usrStrings, &manifest, &includes,
+                               &includedBy, &headers, &names, &nameGrams, &usrNames};
+    for (auto &shard : shards)
+        tables.push_back(shard.get());
+
+    size_t freed = 0;
     try {
-        db.truncate(0, 0, 0);
+        for (Db* table : tables) {
+            // Without a transaction handle Berkeley DB compacts in many
+            // small transactions of its own.
+            DB_COMPACT stats;
+            memset(&stats, 0, sizeof(stats));
+            stats.compact_fillpercent = fillPercent;
+            table->compact(NULL, NULL, NULL, &stats, DB_FREE_SPACE, NULL);
+            freed += stats.compact_pages_truncated;
+        }
+        if (!transactional)
+            for (Db* table : tables)
+                table->sync(0);
     } catch(DbException &e) {
         std::cerr << "Exception thrown: " << e.what() << std::endl;
         exit(1);
     }
+    return freed;
 }
 
-void ClicDb::set(const std::string& usr, const std::set<std::string>& locations) {
-    std::stringstream ss;
+void ClicDb::forgetFiles() {
+    fileIds.clear();
+    fileNameCache.clear();
+}
+
+bool ClicDb::findFileId(const std::string& path, uint32_t& id) {
+    auto cached = fileIds.find(path);
+    if (cached != fileIds.end()) {
+        id = cached->second;
+        return true;
+    }
+    if (!findId(files, fileNames, path, false, id))
+        return false;
+    fileIds[path] = id;
+    return true;
+}
+
+uint32_t ClicDb::fileId(const std::string& path) {
+    uint32_t id;
+    if (!findFileId(path, id)) {
+        findId(files, fileNames, path, true, id);
+        fileIds[path] = id;
+    }
+    return id;
+}
+
+bool ClicDb::findId(Db& ids, Db& strings, StringRef str, bool create, uint32_t& id) {
+    Dbt key(const_cast<char*>(str.data), str.size);
+    Dbt value;
+    if (ids.get(txn, &key, &value, 0) != DB_NOTFOUND) {
+        countGet(key, value);
+        id = decodeId(value);
+        return true;
+    }
+    if (!create)
+        return false;
+
+    // The next id follows the highest one in use. Other writers allocate
+    // from the same table, so it is read under a write lock.
+    id = 0;
+    Dbt last, name;
+    {
+        ClicCursor cursor(strings, txn);
+        if (cursor->get(&last, &name, DB_LAST | (txn ? DB_RMW : 0)) != DB_NOTFOUND)
+            id = decodeId(last) + 1;
+    }
 
-    printLocations(ss, locations);
-    std::string locationsString = ss.str();
-    Dbt key(const_cast<char*>(usr.c_str()), usr.size());
-    Dbt value(const_cast<char*>(locationsString.c_str()), locationsString.size());
-    db.put(NULL, &key, &value, 0);
+    unsigned char idBuf[4];
+    encodeId(id, idBuf);
+    Dbt idDbt(idBuf, sizeof(idBuf));
+    ids.put(txn, &key, &idDbt, 0);
+    strings.put(txn, &idDbt, &key, 0);
+    countPut(key, idDbt);
+    countPut(idDbt, key);
+    return true;
 }
 
-std::set<std::string> ClicDb::get(const std::string& usr) {
-    Dbt key(const_cast<char*>(usr.c_str()), usr.size());
+bool ClicDb::findString(Db& strings, uint32_t id, std::string& str) {
+    unsigned char idBuf[4];
+    encodeId(id, idBuf);
+    Dbt key(idBuf, sizeof(idBuf));
     Dbt value;
+    if (strings.get(txn, &key, &value, 0) == DB_NOTFOUND)
+        return false;
+    countGet(key, value);
+    str.assign(static_cast<const char*>(value.get_data()), value.get_size());
+    return true;
+}
+
+const std::string& ClicDb::fileName(uint32_t id) {
+    auto cached = fileNameCache.find(id);
+    if (cached != fileNameCache.end())
+        return cached->second;
 
-    if (db.get(NULL, &key, &value, 0) == DB_NOTFOUND)
-        return std::set<std::string>();
-    std::string str((char*)value.get_data(), value.get_size());
+    std::string name;
+    readTransaction([&]() {
+        unsigned char idBuf[4];
+        encodeId(id, idBuf);
+        Dbt key(idBuf, sizeof(idBuf));
+        Dbt value;
+        if (fileNames.get(txn, &key, &value, 0) != DB_NOTFOUND)
+            name.assign(static_cast<const char*>(value.get_data()), value.get_size());
+    });
+    return fileNameCache[id] = name;
+}
+
+bool ClicDb::getManifest(const std::string& sourceFilename, ClicManifestEntry& entry) {
+    bool found = false;
+    transaction([&]() {
+        Dbt key(const_cast<char*>(sourceFilename.c_str()), sourceFilename.size());
+        Dbt value;
+        found = manifest.get(txn, &key, &value, 0) != DB_NOTFOUND && value.get_size() == 16;
+        countGet(key, value);
+        if (found)
+            entry = decodeManifestEntry(value.get_data());
+    });
+    return found;
+}
 
-    std::set<std::string> res;
-    for (const auto &i : split(str, '\t'))
-        res.insert(i);
+void ClicDb::setManifest(const std::string& sourceFilename, const ClicManifestEntry& entry) {
+    unsigned char buf[16];
+    encodeManifestEntry(entry, buf);
+    Dbt key(const_cast<char*>(sourceFilename.c_str()), sourceFilename.size());
+    Dbt value(buf, sizeof(buf));
+    transaction([&]() {
+        manifest.put(txn, &key, &value, 0);
+        countPut(key, value);
+    });
+}
+
+void ClicDb::rmManifest(const std::string& sourceFilename) {
+    Dbt key(const_cast<char*>(sourceFilename.c_str()), sourceFilename.size());
+    transaction([&]() {
+        manifest.del(txn, &key, 0);
+        ++counters.dels;
+    });
+}
+
+std::vector<std::string> ClicDb::manifestFiles() {
+    std::vector<std::string> res;
+    transaction([&]() {
+        res.clear();
+        Dbt key, value;
+        ClicCursor cursor(manifest, txn);
+        while (cursor->get(&key, &value, DB_NEXT) != DB_NOTFOUND)
+            res.push_back(std::string(static_cast<const char*>(key.get_data()), key.get_size()));
+    });
     return res;
 }
 
-void ClicDb::addMultiple(const std::string& usr, const std::set<std::string>& locationsToAdd) {
-    if (locationsToAdd.empty())
+void ClicDb::setIncludes(const std::string& sourceFilename,
+                         const std::set<std::string>& headerFilenames) {
+    transaction([&]() {
+        rmIncludes(sourceFilename);
+
+        Dbt source(const_cast<char*>(sourceFilename.c_str()), sourceFilename.size());
+        for (const auto &header : headerFilenames) {
+            Dbt headerDbt(const_cast<char*>(header.c_str()), header.size());
+            includes.put(txn, &source, &headerDbt, DB_NODUPDATA);
+            includedBy.put(txn, &headerDbt, &source, DB_NODUPDATA);
+            countPut(source, headerDbt);
+            countPut(headerDbt, source);
+        }
+    });
+}
+
+void ClicDb::rmIncludes(const std::string& sourceFilename) {
+    transaction([&]() {
+        Dbt source(const_cast<char*>(sourceFilename.c_str()), sourceFilename.size());
+        Dbt key, value;
+        ClicCursor cursor(includedBy, txn);
+
+        for (const auto &header : includedHeaders(sourceFilename)) {
+            Dbt headerDbt(const_cast<char*>(header.c_str()), header.size());
+            key = headerDbt;
+            value = source;
+            if (cursor->get(&key, &value, DB_GET_BOTH) == DB_NOTFOUND)
+                continue;
+            cursor->del(0);
+            ++counters.dels;
+
+            // Forget the hash of headers nobody includes anymore
+            key = headerDbt;
+            if (cursor->get(&key, &value, DB_SET) == DB_NOTFOUND) {
+                headers.del(txn, &headerDbt, 0);
+                ++counters.dels;
+            }
+        }
+
+        includes.del(txn, &source, 0);
+        ++counters.dels;
+    });
+}
+
+std::vector<std::string> ClicDb::includedHeaders(const std::string& sourceFilename) {
+    return duplicates(includes, sourceFilename);
+}
+
+std::vector<std::string> ClicDb::includers(const std::string& header) {
+    return duplicates(includedBy, header);
+}
+
+std::vector<std::string> ClicDb::headersWithPrefix(const std::string& prefix) {
+    std::vector<std::string> res;
+    transaction([&]() {
+        res.clear();
+        Dbt key(const_cast<char*>(prefix.c_str()), prefix.size());
+        Dbt value;
+        ClicCursor cursor(includedBy, txn);
+        for (int ret = cursor->get(&key, &value, DB_SET_RANGE);
+                ret != DB_NOTFOUND;
+                ret = cursor->get(&key, &value, DB_NEXT_NODUP)) {
+            std::string header(static_cast<const char*>(key.get_data()), key.get_size());
+            if (header.compare(0, prefix.size(), prefix) != 0)
+                break;
+            res.push_back(header);
+        }
+    });
+    return res;
+}
+
+std::vector<std::string> ClicDb::duplicates(Db& table, const std::string& keyString) {
+    std::vector<std::string> res;
+    transaction([&]() {
+        res.clear();
+        Dbt key(const_cast<char*>(keyString.c_str()), keyString.size());
+        Dbt value;
+        ClicCursor cursor(table, txn);
+        for (int ret = cursor->get(&key, &value, DB_SET);
+                ret != DB_NOTFOUND;
+                ret = cursor->get(&key, &value, DB_NEXT_DUP))
+            res.push_back(std::string(static_cast<const char*>(value.get_data()), value.get_size()));
+    });
+    return res;
+}
+
+void ClicDb::setHeaderHash(const std::string& header, uint64_t hash) {
+    unsigned char buf[8];
+    for (int i = 0; i != 8; ++i)
+        buf[i] = hash >> (56 - 8 * i);
+    Dbt key(const_cast<char*>(header.c_str()), header.size());
+    Dbt value(buf, sizeof(buf));
+    transaction([&]() {
+        headers.put(txn, &key, &value, 0);
+        countPut(key, value);
+    });
+}
+
+std::vector<std::pair<std::string, uint64_t>> ClicDb::headerHashes() {
+    std::vector<std::pair<std::string, uint64_t>> res;
+    transaction([&]() {
+        res.clear();
+        Dbt key, value;
+        ClicCursor cursor(headers, txn);
+        while (cursor->get(&key, &value, DB_NEXT) != DB_NOTFOUND) {
+            res.push_back(std::make_pair(
+                    std::string(static_cast<const char*>(key.get_data()), key.get_size()),
+                    decodeHash(value)));
+        }
+    });
+    return res;
+}
+
+bool ClicDb::headerHash(const std::string& header, uint64_t& hash) {
+    bool found = false;
+    transaction([&]() {
+        Dbt key(const_cast<char*>(header.c_str()), header.size());
+        Dbt value;
+        found = headers.get(txn, &key, &value, 0) != DB_NOTFOUND;
+        countGet(key, value);
+        if (found)
+            hash = decodeHash(value);
+    });
+    return found;
+}
+
+void ClicDb::forEachLocation(const std::string& usr, const LocationCallback& callback) {
+    ClicResume resume;
+    readTransaction([&]() {
+        Dbt key(const_cast<char*>(usr.c_str()), usr.size());
+        Dbt value;
+        ClicLocation loc;
+        std::string location;
+
+        ClicCursor cursor(*shards[shardOf(usr.data(), usr.size())], txn);
+        for (int ret = cursor->get(&key, &value, DB_SET);
+                ret != DB_NOTFOUND;
+                ret = cursor->get(&key, &value, DB_NEXT_DUP)) {
+            StringRef record(static_cast<const char*>(value.get_data()), value.get_size());
+            if (resume.delivered(usr, record)
+                    || !decodeLocationRecord(record.data, record.size, loc))
+                continue;
+            resume.deliver(usr, record);
+            location.clear();
+            appendLocation(location, fileName(loc.file), loc.line, loc.column, loc.kind);
+            callback(usr, location);
+        }
+    });
+}
+
+void ClicDb::forEachLocationWithPrefix(const std::string& prefix,
+                                       const LocationCallback& callback) {
+    std::string usrString, location;
+    forEachRecordWithPrefix(prefix, [&](StringRef usr, const ClicLocation& loc) {
+        usrString.assign(usr.data, usr.size);
+        location.clear();
+        appendLocation(location, fileName(loc.file), loc.line, loc.column, loc.kind);
+        callback(usrString, location);
+    });
+}
+
+void ClicDb::forEachRecordWithPrefix(const std::string& prefix,
+                                     const RecordCallback& callback) {
+    // A USR lives in exactly one shard, so merging the shards by key alone
+    // keeps its locations together and in order. Every shard reads into
+    // buffers of its own, as its current record must outlive reads from
+    // the others.
+    struct Scan {
+        std::unique_ptr<ClicCursor> cursor;
+        ClicBuffer usr, record;
+        bool valid;
+    };
+    auto advance = [&](Scan& scan, u_int32_t flags) {
+        scan.valid = ClicBuffer::read([&]() {
+                    if (flags == DB_SET_RANGE)
+                        scan.usr.assign(prefix);
+                    return (*scan.cursor)->get(&scan.usr, &scan.record, flags);
+                }) != DB_NOTFOUND
+            && scan.usr.get_size() >= prefix.size()
+            && memcmp(scan.usr.get_data(), prefix.data(), prefix.size()) == 0;
+    };
+
+    ClicResume resume;
+    readTransaction([&]() {
+        std::vector<Scan> scans(shards.size());
+        for (size_t i = 0; i != shards.size(); ++i) {
+            scans[i].cursor.reset(new ClicCursor(*shards[i], txn));
+            advance(scans[i], DB_SET_RANGE);
+        }
+
+        ClicLocation loc;
+        for (;;) {
+            Scan* next = NULL;
+            for (auto &scan : scans) {
+                if (scan.valid && (!next || scan.usr.ref() < next->usr.ref()))
+                    next = &scan;
+            }
+            if (!next)
+                break;
+
+            StringRef record = next->record.ref();
+            if (!resume.delivered(next->usr.ref(), record)
+                    && decodeLocationRecord(record.data, record.size, loc)) {
+                resume.deliver(next->usr.ref(), record);
+                callback(next->usr.ref(), loc);
+            }
+
+            advance(*next, DB_NEXT);
+        }
+    });
+}
+
+void ClicDb::addIndex(const ClicFlatIndex& index, const std::string& sourceFilename) {
+    mergeIndex(index, true, sourceFilename);
+}
+
+void ClicDb::rmIndex(const ClicFlatIndex& index, const std::string& sourceFilename) {
+    mergeIndex(index, false, sourceFilename);
+}
+
+bool ClicDb::rmFile(const std::string& sourceFilename) {
+    return rmContribution(sourceFilename, true);
+}
+
+void ClicDb::unstageFile(const std::string& sourceFilename) {
+    rmContribution(sourceFilename, false);
+}
+
+// Without loaded the references of the contribution never made it to refs
+bool ClicDb::rmContribution(const std::string& sourceFilename, bool loaded) {
+    bool found = false;
+    transaction([&]() {
+        found = false;
+        uint32_t source;
+        if (!findFileId(sourceFilename, source))
+            return;
+
+        unsigned char sourceBuf[4];
+        encodeId(source, sourceBuf);
+        Dbt sourceKey(sourceBuf, sizeof(sourceBuf));
+        Dbt key = sourceKey;
+        // Read into a buffer of our own, as the removal below moves
+        // another cursor before the contribution has been used up
+        ClicBuffer value;
+
+        std::vector<std::string> usrs;
+        {
+            ClicCursor cursor(contributions, txn);
+            ClicCursor counts(refCounts, txn);
+            ShardCursors refs(*this);
+            std::string usr;
+            ClicLocation loc;
+            u_int32_t flags = DB_SET;
+            while (ClicBuffer::read([&]() { return cursor->get(&key, &value, flags); })
+                    != DB_NOTFOUND) {
+                flags = DB_NEXT_DUP;
+                found = true;
+                countGet(key, value);
+                StringRef contribution = value.ref();
+                if (contribution.size < 4
+                        || !findString(usrStrings, decodeId(contribution.data), usr))
+                    continue;
+                usrs.push_back(usr);
+                if (!loaded)
+                    continue;
+
+                StringRef usrId(contribution.data, 4);
+                ClicCursor* usrCounts = hasRefCounts(counts, usrId) ? &counts : nullptr;
+                const char* end = contribution.data + contribution.size;
+                for (const char* p = usrId.data + usrId.size; p != end; ) {
+                    const char* start = p;
+                    if (!readLocationRecord(p, end, loc))
+                        break;
+                    rmRef(refs, usrCounts, usr, usrId, StringRef(start, p - start));
+                }
+            }
+        }
+
+        contributions.del(txn, &sourceKey, 0);
+        ++counters.dels;
+        forgetUnusedUsrs(usrs);
+        if (!transactional)
+            syncShards();
+    });
+    return found;
+}
+
+void ClicDb::fileIndex(const std::string& sourceFilename, ClicFlatIndex& index) {
+    transaction([&]() {
+        index.clear();
+        uint32_t source;
+        if (!findFileId(sourceFilename, source))
+            return;
+
+        unsigned char sourceBuf[4];
+        encodeId(source, sourceBuf);
+        Dbt key(sourceBuf, sizeof(sourceBuf));
+        ClicBuffer value;
+        std::string usr;
+        ClicLocation loc;
+
+        ClicCursor cursor(contributions, txn);
+        u_int32_t flags = DB_SET;
+        while (ClicBuffer::read([&]() { return cursor->get(&key, &value, flags); })
+                != DB_NOTFOUND) {
+            flags = DB_NEXT_DUP;
+            StringRef contribution = value.ref();
+            if (contribution.size < 4
+                    || !findString(usrStrings, decodeId(contribution.data), usr))
+                continue;
+            uint32_t usrIndex = index.internUsr(usr.data(), usr.size());
+            const char* end = contribution.data + contribution.size;
+            for (const char* p = contribution.data + 4; p != end && readLocationRecord(p, end, loc); ) {
+                const std::string& path = fileName(loc.file);
+                index.add(usrIndex, index.internFile(path.data(), path.size()),
+                          loc.line, loc.column, loc.kind);
+            }
+        }
+    });
+    index.finalize();
+}
+
+void ClicDb::addRef(ShardCursors& refs, StringRef usr, StringRef usrId, StringRef record) {
+    Dbt key(const_cast<char*>(usr.data), usr.size);
+    Dbt value(const_cast<char*>(record.data), record.size);
+    countPut(key, value);
+    if (refs(usr.data, usr.size)->put(&key, &value, DB_NODUPDATA) != DB_KEYEXIST)
         return;
 
-    std::set<std::string> storedLocations = get(usr);
-    std::copy(locationsToAdd.begin(), locationsToAdd.end(), std::inserter(storedLocations, storedLocations.begin()));
-    set(usr, storedLocations);
+    countKey.assign(usrId.data, usrId.size);
+    countKey.append(record.data, record.size);
+    Dbt countKeyDbt(const_cast<char*>(countKey.data()), countKey.size());
+    Dbt count;
+    uint32_t others = 0;
+    if (refCounts.get(txn, &countKeyDbt, &count, 0) != DB_NOTFOUND) {
+        countGet(countKeyDbt, count);
+        others = decodeId(count);
+    }
+    unsigned char countBuf[4];
+    encodeId(others + 1, countBuf);
+    Dbt newCount(countBuf, sizeof(countBuf));
+    refCounts.put(txn, &countKeyDbt, &newCount, 0);
+    countPut(countKeyDbt, newCount);
 }
 
-void ClicDb::rmMultiple(const std::string& usr, const std::set<std::string> &locationsToRemove) {
-    std::set<std::string> storedLocations = get(usr);
-    size_t originalCount = storedLocations.size();
-    for (const auto &loc : locationsToRemove)
-        storedLocations.erase(loc);
-    if (storedLocations.size() < originalCount)
-        set(usr, storedLocations);
+void ClicDb::rmRef(ShardCursors& refs, ClicCursor* counts, StringRef usr, StringRef usrId,
+                   StringRef record) {
+    if (counts) {
+        countKey.assign(usrId.data, usrId.size);
+        countKey.append(record.data, record.size);
+        Dbt countKeyDbt(const_cast<char*>(countKey.data()), countKey.size());
+        Dbt count;
+        if ((*counts)->get(&countKeyDbt, &count, DB_SET) != DB_NOTFOUND) {
+            countGet(countKeyDbt, count);
+            uint32_t others = decodeId(count);
+            if (others > 1) {
+                unsigned char countBuf[4];
+                encodeId(others - 1, countBuf);
+                Dbt newCount(countBuf, sizeof(countBuf));
+                (*counts)->put(&countKeyDbt, &newCount, DB_CURRENT);
+                countPut(countKeyDbt, newCount);
+            } else {
+                (*counts)->del(0);
+                ++counters.dels;
+            }
+            return;
+        }
+    }
+
+    Dbt key(const_cast<char*>(usr.data), usr.size);
+    Dbt value(const_cast<char*>(record.data), record.size);
+    refs(usr.data, usr.size).rm(&key, &value);
+    ++counters.dels;
+}
+
+bool ClicDb::hasRefCounts(ClicCursor& counts, StringRef usrId) {
+    // The counts of a USR sort together behind its id
+    Dbt key(const_cast<char*>(usrId.data), usrId.size);
+    Dbt value;
+    if (counts->get(&key, &value, DB_SET_RANGE) == DB_NOTFOUND)
+        return false;
+    countGet(key, value);
+    return key.get_size() >= usrId.size && memcmp(key.get_data(), usrId.data, usrId.size) == 0;
+}
+
+bool ClicDb::readContribution(ClicCursor& cursor, Dbt& source, StringRef usrId,
+                              ClicBuffer& buffer, StringRef& records) {
+    // The contributions of a source file sort by USR id, so the first one
+    // from usrId on is the one of the USR if there is any
+    Dbt key(source.get_data(), source.get_size());
+    // A retry after growing the buffer has to look up usrId again
+    if (ClicBuffer::read([&]() {
+                buffer.assign(usrId);
+                return cursor->get(&key, &buffer, DB_GET_BOTH_RANGE);
+            }) == DB_NOTFOUND)
+        return false;
+    StringRef contribution = buffer.ref();
+    if (contribution.size < usrId.size || memcmp(contribution.data, usrId.data, usrId.size) != 0)
+        return false;
+    countGet(key, buffer);
+    records = StringRef(contribution.data + usrId.size, contribution.size - usrId.size);
+    return true;
+}
+
+void ClicDb::writeContribution(ClicCursor& cursor, Dbt& source, StringRef usrId, bool found,
+                               StringRef contribution) {
+    if (found) {
+        cursor->del(0);
+        ++counters.dels;
+    }
+    if (contribution.size == usrId.size)
+        return;
+
+    Dbt value(const_cast<char*>(contribution.data), contribution.size);
+    cursor->put(&source, &value, DB_NODUPDATA);
+    countPut(source, value);
+}
+
+void ClicDb::addName(const StringRef& usr, const StringRef& spelling, uint32_t kind) {
+    // The first name recorded for a USR sticks
+    std::string kindString = std::to_string(kind);
+    std::string name = spelling.str() + '\0' + kindString;
+    Dbt usrDbt(const_cast<char*>(usr.data), usr.size);
+    Dbt nameDbt(const_cast<char*>(name.data()), name.size());
+    countPut(usrDbt, nameDbt);
+    if (usrNames.put(txn, &usrDbt, &nameDbt, DB_NOOVERWRITE) == DB_KEYEXIST)
+        return;
+
+    std::string value = usr.str() + '\0' + kindString;
+    Dbt spellingDbt(const_cast<char*>(spelling.data), spelling.size);
+    Dbt valueDbt(const_cast<char*>(value.data()), value.size());
+    Dbt existing;
+    ++counters.gets;
+    bool newName = names.get(txn, &spellingDbt, &existing, 0) == DB_NOTFOUND;
+    names.put(txn, &spellingDbt, &valueDbt, DB_NODUPDATA);
+    countPut(spellingDbt, valueDbt);
+    if (newName)
+        addNameGrams(spelling);
+}
+
+void ClicDb::addNameGrams(const StringRef& spelling) {
+    Dbt spellingDbt(const_cast<char*>(spelling.data), spelling.size);
+    for (const auto &gram : gramsOf(spelling)) {
+        Dbt gramDbt(const_cast<char*>(gram.data()), gram.size());
+        nameGrams.put(txn, &gramDbt, &spellingDbt, DB_NODUPDATA);
+        countPut(gramDbt, spellingDbt);
+    }
+}
+
+void ClicDb::rmNameGrams(const StringRef& spelling) {
+    Dbt spellingDbt(const_cast<char*>(spelling.data), spelling.size);
+    ClicCursor cursor(nameGrams, txn);
+    for (const auto &gram : gramsOf(spelling)) {
+        Dbt gramDbt(const_cast<char*>(gram.data()), gram.size());
+        cursor.rm(&gramDbt, &spellingDbt);
+        ++counters.dels;
+    }
+}
+
+void ClicDb::forgetUnusedUsrs(const std::vector<std::string>& usrs) {
+    ClicBuffer name;
+    std::string entry;
+    for (const auto &usr : usrs) {
+        Dbt key(const_cast<char*>(usr.data()), usr.size());
+        Dbt value;
+        ++counters.gets;
+        if (shards[shardOf(usr.data(), usr.size())]->get(txn, &key, &value, 0) != DB_NOTFOUND)
+            continue;
+
+        // Without references no contribution or count refers to the id
+        uint32_t id;
+        if (findId(usrIds, usrStrings, usr, false, id)) {
+            unsigned char idBuf[4];
+            encodeId(id, idBuf);
+            Dbt idDbt(idBuf, sizeof(idBuf));
+            usrIds.del(txn, &key, 0);
+            usrStrings.del(txn, &idDbt, 0);
+            counters.dels += 2;
+        }
+
+        if (ClicBuffer::read([&]() { return usrNames.get(txn, &key, &name, 0); }) == DB_NOTFOUND)
+            continue;
+        countGet(key, name);
+
+        StringRef nameRef = name.ref();
+        const char* sep = static_cast<const char*>(memchr(nameRef.data, '\0', nameRef.size));
+        if (sep) {
+            entry.assign(usr);
+            entry.append(sep, nameRef.data + nameRef.size - sep);
+            Dbt spelling(const_cast<char*>(nameRef.data), sep - nameRef.data);
+            Dbt entryDbt(const_cast<char*>(entry.data()), entry.size());
+            ClicCursor(names, txn).rm(&spelling, &entryDbt);
+            ++counters.dels;
+            // The grams go with the last USR of the name
+            Dbt rest;
+            ++counters.gets;
+            if (names.get(txn, &spelling, &rest, 0) == DB_NOTFOUND)
+                rmNameGrams(StringRef(nameRef.data, sep - nameRef.data));
+        }
+        usrNames.del(txn, &key, 0);
+        ++counters.dels;
+    }
+}
+
+void ClicDb::findNames(const std::string& pattern, bool substring,
+                       const NameCallback& callback) {
+    ClicResume resume;
+    readTransaction([&]() {
+        std::string name;
+        auto deliver = [&](const Dbt& value) {
+            const char* data = static_cast<const char*>(value.get_data());
+            StringRef entry(data, value.get_size());
+            const char* sep = static_cast<const char*>(memchr(data, '\0', value.get_size()));
+            if (!sep || resume.delivered(name, entry))
+                return;
+            resume.deliver(name, entry);
+            callback(name, std::string(data, sep - data),
+                     strtoul(std::string(sep + 1, data + value.get_size()).c_str(), NULL, 10));
+        };
+        ClicCursor cursor(names, txn);
+
+        if (substring && pattern.size() >= nameGramSize) {
+            // Every name containing the pattern contains its rarest gram
+            // too, and the names of a gram are in name order.
+            ClicCursor grams(nameGrams, txn);
+            std::string rarest;
+            db_recno_t fewest = 0;
+            for (const auto &gram : gramsOf(pattern)) {
+                Dbt key(const_cast<char*>(gram.data()), gram.size());
+                Dbt value;
+                db_recno_t count = 0;
+                if (grams->get(&key, &value, DB_SET) != DB_NOTFOUND)
+                    grams->count(&count, 0);
+                if (!count)
+                    return;
+                if (rarest.empty() || count < fewest) {
+                    rarest = gram;
+                    fewest = count;
+                }
+            }
+
+            Dbt key(const_cast<char*>(rarest.data()), rarest.size());
+            Dbt spelling;
+            for (int ret = grams->get(&key, &spelling, DB_SET);
+                    ret != DB_NOTFOUND;
+                    ret = grams->get(&key, &spelling, DB_NEXT_DUP)) {
+                name.assign(static_cast<const char*>(spelling.get_data()), spelling.get_size());
+                if (name.find(pattern) == std::string::npos)
+                    continue;
+                Dbt nameKey(const_cast<char*>(name.data()), name.size());
+                Dbt value;
+                for (int found = cursor->get(&nameKey, &value, DB_SET);
+                        found != DB_NOTFOUND;
+                        found = cursor->get(&nameKey, &value, DB_NEXT_DUP))
+                    deliver(value);
+            }
+            return;
+        }
+
+        Dbt key, value;
+        u_int32_t flags = DB_FIRST;
+        if (!substring) {
+            key = Dbt(const_cast<char*>(pattern.c_str()), pattern.size());
+            flags = DB_SET_RANGE;
+        }
+        while (cursor->get(&key, &value, flags) != DB_NOTFOUND) {
+            name.assign(static_cast<const char*>(key.get_data()), key.get_size());
+            if (!substring && name.compare(0, pattern.size(), pattern) != 0)
+                break;
+            // Skip all USRs of a name that does not match at once
+            if (substring && name.find(pattern) == std::string::npos) {
+                flags = DB_NEXT_NODUP;
+                continue;
+            }
+            flags = DB_NEXT;
+            deliver(value);
+        }
+    });
+}
+
+void ClicDb::stageIndex(const ClicFlatIndex& index, const std::string& sourceFilename,
+                        std::vector<std::string>& records) {
+    transaction([&]() {
+        records.clear();
+        mergeIndex(index, true, sourceFilename, &records);
+    });
+}
+
+void ClicDb::bulkLoad(const std::function<bool(std::string& record, uint32_t& copies)>& next) {
+    // Every batch is a transaction of its own, so a deadlock only repeats
+    // the batch and the locks held stay bounded.
+    static const size_t batchSize = 10000;
+    std::vector<std::pair<std::string, uint32_t>> batch;
+    std::string record;
+    uint32_t copies;
+    bool more = true;
+
+    while (more) {
+        batch.clear();
+        while (batch.size() != batchSize && (more = next(record, copies)))
+            batch.push_back(std::make_pair(record, copies));
+
+        transaction([&]() {
+            ShardCursors cursors(*this);
+            for (const auto &it : batch) {
+                std::string::size_type sep = it.first.find('\0');
+                if (sep == std::string::npos)
+                    continue;
+                Dbt key(const_cast<char*>(it.first.data()), sep);
+                Dbt value(const_cast<char*>(it.first.data()) + sep + 1, it.first.size() - sep - 1);
+                cursors(it.first.data(), sep)->put(&key, &value, DB_NODUPDATA);
+                countPut(key, value);
+
+                // stageIndex gave the USR its id
+                uint32_t id;
+                if (it.second == 1
+                        || !findId(usrIds, usrStrings, StringRef(it.first.data(), sep), false, id))
+                    continue;
+                unsigned char idBuf[4];
+                encodeId(id, idBuf);
+                std::string countKey(reinterpret_cast<char*>(idBuf), sizeof(idBuf));
+                countKey.append(it.first, sep + 1, std::string::npos);
+                unsigned char countBuf[4];
+                encodeId(it.second - 1, countBuf);
+                Dbt countKeyDbt(const_cast<char*>(countKey.data()), countKey.size());
+                Dbt count(countBuf, sizeof(countBuf));
+                refCounts.put(txn, &countKeyDbt, &count, 0);
+                countPut(countKeyDbt, count);
+            }
+        });
+    }
+    if (!transactional)
+        syncShards();
+}
+
+void ClicDb::mergeIndex(const ClicFlatIndex& index, bool add,
+                        const std::string& sourceFilename,
+                        std::vector<std::string>* staged) {
+    static const uint32_t unmapped = ~0u;
+    static const uint32_t unknown = ~0u - 1;
+
+    transaction([&]() {
+        // Only what the source file contributed can be removed
+        uint32_t source;
+        if (add)
+            source = fileId(sourceFilename);
+        else if (!findFileId(sourceFilename, source))
+            return;
+        unsigned char sourceBuf[4];
+        encodeId(source, sourceBuf);
+        Dbt sourceKey(sourceBuf, sizeof(sourceBuf));
+
+        // Index file ids to database file ids, resolved on first use
+        std::vector<uint32_t> files(index.fileCount(), unmapped);
+        // The location records of a USR in the index back to back, and
+        // sorted views of them, merged with what the source file
+        // contributed before into merged. The buffers are reused from USR
+        // to USR.
+        std::string encoded;
+        std::vector<std::pair<size_t, size_t>> spans;
+        std::vector<StringRef> sorted;
+        ClicBuffer contribution;
+        std::string merged;
+        std::string entry;
+        ClicLocation loc;
+        std::vector<std::string> removedUsrs;
+
+        {
+            ShardCursors refs(*this);
+            ClicCursor reverseCursor(contributions, txn);
+            ClicCursor counts(refCounts, txn);
+            const std::vector<ClicFlatIndex::Reference>& references = index.references();
+            // References are sorted by USR, and each USR is merged as a whole
+            for (size_t first = 0, last = 0; first != references.size(); first = last) {
+                uint32_t usrIndex = references[first].usr;
+                while (last != references.size() && references[last].usr == usrIndex)
+                    ++last;
+                StringRef usr = index.usr(usrIndex);
+                if (usr.empty())
+                    continue;
+
+                uint32_t id;
+                if (!findId(usrIds, usrStrings, usr, add, id))
+                    continue;
+                unsigned char idBuf[4];
+                encodeId(id, idBuf);
+                StringRef usrId(reinterpret_cast<char*>(idBuf), sizeof(idBuf));
+
+                StringRef spelling;
+                uint32_t kind;
+                if (!add)
+                    removedUsrs.push_back(usr.str());
+                else if (index.name(usrIndex, spelling, kind))
+                    addName(usr, spelling, kind);
+
+                encoded.clear();
+                spans.clear();
+                for (size_t i = first; i != last; ++i) {
+                    const ClicFlatIndex::Reference& ref = references[i];
+                    uint32_t& file = files[ref.file];
+                    if (file == unmapped) {
+                        std::string path = index.file(ref.file).str();
+                        if (add)
+                            file = fileId(path);
+                        else if (!findFileId(path, file))
+                            file = unknown;
+                    }
+                    if (file == unknown)
+                        continue;
+
+                    loc.file = file;
+                    loc.line = ref.line;
+                    loc.column = ref.column;
+                    loc.kind = ref.kind;
+                    size_t offset = encoded.size();
+                    encodeLocationRecord(loc, encoded);
+                    spans.push_back(std::make_pair(offset, encoded.size() - offset));
+                }
+                // A reference counts once per source file
+                sorted.clear();
+                for (const auto &span : spans)
+                    sorted.push_back(StringRef(encoded.data() + span.first, span.second));
+                std::sort(sorted.begin(), sorted.end());
+                sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+                StringRef contributed;
+                bool found = readContribution(reverseCursor, sourceKey, usrId,
+                                              contribution, contributed);
+                if (!add && !found)
+                    continue;
+                ClicCursor* usrCounts = !add && hasRefCounts(counts, usrId) ? &counts : nullptr;
+
+                // Both sides are sorted, so one pass finds the references
+                // the source file starts or stops contributing
+                bool changed = false;
+                auto addNew = [&](StringRef record) {
+                    if (staged) {
+                        entry.assign(usr.data, usr.size);
+                        entry += '\0';
+                        entry.append(record.data, record.size);
+                        staged->push_back(entry);
+                    } else {
+                        addRef(refs, usr, usrId, record);
+                    }
+                    merged.append(record.data, record.size);
+                    changed = true;
+                };
+                merged.assign(usrId.data, usrId.size);
+                auto next = sorted.begin();
+                const char* end = contributed.data + contributed.size;
+                for (const char* p = contributed.data; p != end; ) {
+                    const char* start = p;
+                    if (!readLocationRecord(p, end, loc))
+                        break;
+                    StringRef record(start, p - start);
+                    for (; next != sorted.end() && *next < record; ++next) {
+                        if (add)
+                            addNew(*next);
+                    }
+                    if (next != sorted.end() && *next == record) {
+                        ++next;
+                        if (!add) {
+                            rmRef(refs, usrCounts, usr, usrId, record);
+                            changed = true;
+                            continue;
+                        }
+                    }
+                    merged.append(record.data, record.size);
+                }
+                for (; add && next != sorted.end(); ++next)
+                    addNew(*next);
+                if (changed)
+                    writeContribution(reverseCursor, sourceKey, usrId, found, merged);
+            }
+        }
+        forgetUnusedUsrs(removedUsrs);
+        if (!transactional)
+            syncShards();
+    });
 }
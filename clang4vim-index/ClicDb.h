@@ -2,41 +2,357 @@
 
 #include <db_cxx.h>
 
+#include <functional>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "types.h"
+#include "clic_flat_index.h"
+#include "clic_location.h"
+#include "clic_manifest.h"
+
+// index.db holds these databases:
+//   refs          USR -> location, one sorted duplicate per location
+//                 (see encodeLocationRecord). A sharded database keeps it
+//                 in the files index.db.0 ... index.db.<n-1> instead,
+//                 picked by a hash of the USR. It is the only table with
+//                 a record per reference and the only one queried by USR
+//                 alone; the others stay in index.db.
+//   meta          settings fixed when the database is created, and whether
+//                 a build is under way
+//   contributions source file id -> USR id followed by the location records
+//                 the source file added to refs for the USR, one sorted
+//                 duplicate per USR
+//   refcounts     USR id + location record -> number of source files beyond
+//                 the first that contributed the reference, absent for one
+//   files         path -> file id
+//   filenames     file id -> path
+//   usrids        USR -> USR id, dropped with the last reference to the USR
+//   usrs          USR id -> USR
+//   manifest      source file -> what it was last indexed from
+//   includes      source file -> header, one sorted duplicate per header
+//   includedby    header -> source file, one sorted duplicate per source file
+//   headers       header -> hash of its contents when last indexed
+//   names         entity name -> USR '\0' cursor kind, one sorted duplicate
+//                 per USR
+//   namegrams     three bytes -> entity name, one sorted duplicate per name
+//                 containing them, for substring searches
+//   usrnames      USR -> entity name '\0' cursor kind, dropped with the last
+//                 reference to the USR
+
+struct ClicDbOptions {
+    // Open index.db in a transactional environment kept next to it, so
+    // several processes can write to it at once and a crash leaves it
+    // consistent. Fixed when the database is created.
+    bool transactional = false;
+    // Size of the shared page cache in MiB, 0 for the Berkeley DB default.
+    unsigned cacheSizeMb = 0;
+    // Number of files the references are split over. Only used when the
+    // database is created; 0 keeps what an existing database has and
+    // creates a single one otherwise. The tables keyed by source file,
+    // and names and usrnames, which hold a record per entity rather than
+    // per reference, are not split.
+    unsigned shards = 0;
+};
+
+// Reads, writes and deletes of records done by the methods that index
+// and remove files, with the bytes of keys and values moved
+struct ClicDbStats {
+    uint64_t gets = 0;
+    uint64_t getBytes = 0;
+    uint64_t puts = 0;
+    uint64_t putBytes = 0;
+    uint64_t dels = 0;
+};
+
+// Every public method is atomic. transaction() groups several of them into
+// one; with a transactional environment the body is run again if it loses
+// a deadlock, so it must not have side effects outside the database.
 class ClicDb {
 public:
-    ClicDb(const char* dbFilename);
+    typedef std::function<void(const std::string& usr,
+                               const std::string& location)> LocationCallback;
+    // usr is only valid during the call
+    typedef std::function<void(StringRef usr,
+                               const ClicLocation& location)> RecordCallback;
+    typedef std::function<void(const std::string& name, const std::string& usr,
+                               uint32_t kind)> NameCallback;
+
+    ClicDb(const char* dbFilename, const ClicDbOptions& options = ClicDbOptions());
     ~ClicDb();
 
+    void transaction(const std::function<void()>& body);
+
     void clear();
+    // Set by build from clearing the database until the references are
+    // loaded. A database left with it set has manifests for files whose
+    // references are missing.
+    void setBuilding(bool building);
+    bool building();
+    // Rewrites the B-tree pages of every table filled to fillPercent and
+    // returns the pages freed to the file system. Other processes can keep
+    // using a transactional database meanwhile.
+    size_t compact(unsigned fillPercent);
+    // The files the database consists of
+    const std::vector<std::string>& filenames() const { return dbFilenames; }
+
+    // Stream the locations of one USR, or of every USR starting with
+    // prefix, in key order without collecting them first.
+    void forEachLocation(const std::string& usr, const LocationCallback& callback);
+    void forEachLocationWithPrefix(const std::string& prefix,
+                                   const LocationCallback& callback);
+    // The same with the file of every location left as its id
+    void forEachRecordWithPrefix(const std::string& prefix,
+                                 const RecordCallback& callback);
+    const std::string& fileName(uint32_t id);
+
+    // The entities whose name starts with pattern, or contains it if
+    // substring is set, in name order. A substring search only reads the
+    // names sharing the rarest three bytes of the pattern, but one for
+    // fewer than three bytes reads all names.
+    void findNames(const std::string& pattern, bool substring,
+                   const NameCallback& callback);
+
+    // Add the references of a source file and remember them as its
+    // contribution, so they can later be removed without the index. The
+    // whole index is applied in one pass: the USRs are visited in key order
+    // through a single cursor and the database is flushed once at the end.
+    // A reference several source files contributed stays until the last
+    // of them removes it.
+    void addIndex(const ClicFlatIndex& index, const std::string& sourceFilename);
+    void rmIndex(const ClicFlatIndex& index, const std::string& sourceFilename);
+    // Remove everything a source file contributed. Returns false if the
+    // file never contributed anything.
+    bool rmFile(const std::string& sourceFilename);
+    // The contribution of a source file, finalized.
+    void fileIndex(const std::string& sourceFilename, ClicFlatIndex& index);
 
-    void set(const std::string& usr, const std::set<std::string>& locations);
-    std::set<std::string> get(const std::string& usr);
+    // Bulk loading: stageIndex records the contribution of a source file
+    // like addIndex, but returns its references as "USR '\0' location
+    // record" strings instead of writing them. bulkLoad appends such
+    // strings, delivered in memcmp order with the number of source files
+    // that staged each, to refs.
+    void stageIndex(const ClicFlatIndex& index, const std::string& sourceFilename,
+                    std::vector<std::string>& records);
+    void bulkLoad(const std::function<bool(std::string& record, uint32_t& copies)>& next);
+    // Drops a contribution stageIndex recorded whose references were not
+    // loaded, without touching refs. Only the USRs it leaves without
+    // references are forgotten, so it belongs after bulkLoad.
+    void unstageFile(const std::string& sourceFilename);
 
-    void addMultiple(const std::string &usr,
-                     const std::set<std::string> &locationsToAdd);
-    void rmMultiple(const std::string &usr,
-                    const std::set<std::string> &locationsToRemove);
+    bool getManifest(const std::string& sourceFilename, ClicManifestEntry& entry);
+    void setManifest(const std::string& sourceFilename, const ClicManifestEntry& entry);
+    void rmManifest(const std::string& sourceFilename);
+    std::vector<std::string> manifestFiles();
+
+    // The include graph: every header a source file was indexed with.
+    void setIncludes(const std::string& sourceFilename,
+                     const std::set<std::string>& headers);
+    void rmIncludes(const std::string& sourceFilename);
+    std::vector<std::string> includedHeaders(const std::string& sourceFilename);
+    std::vector<std::string> includers(const std::string& header);
+    // The headers with includers whose path starts with prefix
+    std::vector<std::string> headersWithPrefix(const std::string& prefix);
+
+    void setHeaderHash(const std::string& header, uint64_t hash);
+    bool headerHash(const std::string& header, uint64_t& hash);
+    std::vector<std::pair<std::string, uint64_t>> headerHashes();
+
+    const ClicDbStats& stats() const { return counters; }
 
 private:
-    /*
+    void runTransaction(const std::function<void()>& body, u_int32_t txnFlags);
+    // The streaming reads run like transaction(), but only see committed
+    // data and keep no read locks behind their cursors. A read that loses
+    // a deadlock starts over and skips what it already delivered.
+    void readTransaction(const std::function<void()>& body) {
+        runTransaction(body, DB_READ_COMMITTED);
+    }
+
+    void mergeIndex(const ClicFlatIndex& index, bool add,
+                    const std::string& sourceFilename,
+                    std::vector<std::string>* staged = nullptr);
+    bool rmContribution(const std::string& sourceFilename, bool loaded);
+    std::vector<std::string> duplicates(Db& table, const std::string& key);
+    void addName(const StringRef& usr, const StringRef& spelling, uint32_t kind);
+    // Drops the names and ids of the USRs left without references
+    void forgetUnusedUsrs(const std::vector<std::string>& usrs);
+    void addNameGrams(const StringRef& spelling);
+    void rmNameGrams(const StringRef& spelling);
+    void forgetFiles();
+
+    void countGet(const Dbt& key, const Dbt& value) {
+        ++counters.gets;
+        counters.getBytes += key.get_size() + value.get_size();
+    }
+    void countPut(const Dbt& key, const Dbt& value) {
+        ++counters.puts;
+        counters.putBytes += key.get_size() + value.get_size();
+    }
+
+    size_t shardOf(const char* usr, size_t size) const;
+    void syncShards();
+
+    uint32_t fileId(const std::string& path);
+    bool findFileId(const std::string& path, uint32_t& id);
+    // The id of str in ids, allocated in ids and strings if create is set
+    bool findId(Db& ids, Db& strings, StringRef str, bool create, uint32_t& id);
+    bool findString(Db& strings, uint32_t id, std::string& str);
+
+    // Cursors must be closed before their transaction is aborted, also
+    // when a deadlock unwinds the stack.
     class ClicCursor {
     public:
-        explicit ClicCursor(Db& db) : cursor(nullptr) {
-            db.cursor(0, &cursor, 0);
+        ClicCursor(Db& db, DbTxn* txn) : cursor(nullptr) {
+            db.cursor(txn, &cursor, 0);
         }
         void rm(Dbt* key, Dbt* value) {
             if (cursor->get(key, value, DB_GET_BOTH) != DB_NOTFOUND)
                 cursor->del(0);
         }
+        Dbc* get() { return cursor; }
+        Dbc* operator->() { return cursor; }
         ~ClicCursor() {
-            cursor->close();
+            try {
+                cursor->close();
+            } catch(DbException &) {
+            }
         }
     private:
+        ClicCursor(const ClicCursor&);
+        ClicCursor& operator=(const ClicCursor&);
         Dbc* cursor;
-    };*/
+    };
+
+    // A Dbt that reads into memory of its own, reused from read to read.
+    // What it holds stays valid while other cursors move, and reading
+    // allocates nothing once it has grown to fit the largest record.
+    class ClicBuffer : public Dbt {
+    public:
+        ClicBuffer() : memory(256) {
+            fit();
+        }
+        StringRef ref() const {
+            return StringRef(memory.data(), get_size());
+        }
+        // Makes the buffer the input of a lookup
+        void assign(StringRef str) {
+            set_size(str.size);
+            fit();
+            memcpy(memory.data(), str.data, str.size);
+        }
+        // Runs read again after growing the buffer it did not fit into.
+        // Only ClicBuffers read into user memory, so the Dbt of the
+        // exception is always one.
+        template<class Read>
+        static int read(Read read) {
+            for (;;) {
+                try {
+                    return read();
+                } catch(DbMemoryException &e) {
+                    static_cast<ClicBuffer*>(e.get_dbt())->fit();
+                }
+            }
+        }
+    private:
+        ClicBuffer(const ClicBuffer&);
+        ClicBuffer& operator=(const ClicBuffer&);
+
+        // After DB_BUFFER_SMALL the size is the one needed
+        void fit() {
+            if (memory.size() < get_size())
+                memory.resize(get_size());
+            set_data(memory.data());
+            set_ulen(memory.size());
+            set_flags(DB_DBT_USERMEM);
+        }
+
+        std::vector<char> memory;
+    };
+
+    // The last key and value a streaming read handed out. Reads deliver in
+    // key and value order, so after a restart whatever does not sort after
+    // them has been delivered already.
+    class ClicResume {
+    public:
+        ClicResume() : any(false) {}
+        bool delivered(StringRef key, StringRef value) const {
+            return any && (key < StringRef(lastKey)
+                           || (key == StringRef(lastKey) && !(StringRef(lastValue) < value)));
+        }
+        void deliver(StringRef key, StringRef value) {
+            any = true;
+            lastKey.assign(key.data, key.size);
+            lastValue.assign(value.data, value.size);
+        }
+    private:
+        bool any;
+        std::string lastKey;
+        std::string lastValue;
+    };
+
+    // Opens the cursor of a shard when a USR first maps to it
+    class ShardCursors {
+    public:
+        explicit ShardCursors(ClicDb& db) : db(db), cursors(db.shards.size()) {}
+        ClicCursor& operator()(const char* usr, size_t size) {
+            size_t shard = db.shardOf(usr, size);
+            std::unique_ptr<ClicCursor>& cursor = cursors[shard];
+            if (!cursor)
+                cursor.reset(new ClicCursor(*db.shards[shard], db.txn));
+            return *cursor;
+        }
+    private:
+        ClicDb& db;
+        std::vector<std::unique_ptr<ClicCursor>> cursors;
+    };
+
+    // A reference goes into refs with its first contributor and out with
+    // its last; refcounts counts the others. rmRef only looks for a count
+    // with the counts cursor of a USR that hasRefCounts found any for, so
+    // the references of a USR that no two files share cost no lookup.
+    void addRef(ShardCursors& refs, StringRef usr, StringRef usrId, StringRef record);
+    void rmRef(ShardCursors& refs, ClicCursor* counts, StringRef usr, StringRef usrId,
+               StringRef record);
+    bool hasRefCounts(ClicCursor& counts, StringRef usrId);
+    // Reads what source contributed for a USR into buffer, sets records to
+    // the location records in it and leaves the cursor on it. Returns false
+    // if it contributed nothing.
+    bool readContribution(ClicCursor& cursor, Dbt& source, StringRef usrId,
+                          ClicBuffer& buffer, StringRef& records);
+    // Replaces what readContribution found with contribution, the USR id
+    // followed by the records, or drops it if there are no records
+    void writeContribution(ClicCursor& cursor, Dbt& source, StringRef usrId, bool found,
+                           StringRef contribution);
+
+    bool transactional;
+    DbTxn* txn;
+    // The refcounts key of a reference, reused from reference to reference
+    std::string countKey;
+
+    std::vector<std::string> dbFilenames;
+
+    DbEnv env;
+    std::vector<std::unique_ptr<Db>> shards;
+    Db meta;
+    Db contributions;
+    Db refCounts;
+    Db files;
+    Db fileNames;
+    Db usrIds;
+    Db usrStrings;
+    Db manifest;
+    Db includes;
+    Db includedBy;
+    Db headers;
+    Db names;
+    Db nameGrams;
+    Db usrNames;
 
-    Db db;
+    ClicDbStats counters;
+    std::unordered_map<std::string, uint32_t> fileIds;
+    std::unordered_map<uint32_t, std::string> fileNameCache;
 };
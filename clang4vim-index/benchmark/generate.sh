@@ -0,0 +1,65 @@
+#!/bin/bash
+# Writes a synthetic C++ project to $1 with $2 source files, $3 headers and
+# templates instantiated $4 levels deep. The output only depends on the
+# arguments, so every run indexes exactly the same code.
+#
+# The indexer records the references found in headers, so that is where
+# the code goes: header i includes header i - 1 and builds on its types,
+# and source file j includes two of them. Higher headers are heavier to
+# parse, like a project's common headers.
+
+if [ $# -ne 4 ]; then
+    echo "Usage: $0 <directory> <files> <headers> <templateDepth>" >&2
+    exit 1
+fi
+
+DIR=$1
+FILES=$2
+HEADERS=$3
+DEPTH=$4
+
+mkdir -p $DIR/include $DIR/src || exit 1
+
+for ((i = 0; i < HEADERS; i++)); do
+    {
+        echo "#pragma once"
+        if [ $i -gt 0 ]; then
+            echo "#include \"h$((i - 1)).h\""
+        fi
+        echo "namespace bench {"
+        echo "template<int N> struct Chain$i {"
+        echo "    static int value(int x) { return Chain$i<N - 1>::value(x) + N; }"
+        echo "};"
+        echo "template<> struct Chain$i<0> {"
+        echo "    static int value(int x) { return x; }"
+        echo "};"
+        if [ $i -gt 0 ]; then
+            echo "struct Node$i : Node$((i - 1)) {"
+            echo "    int sum(int x) const { return get() + Node$((i - 1))::sum(x) + Chain$i<$DEPTH>::value(x); }"
+        else
+            echo "struct Node$i {"
+            echo "    int field;"
+            echo "    int get() const { return field; }"
+            echo "    int sum(int x) const { return get() + Chain$i<$DEPTH>::value(x); }"
+        fi
+        echo "};"
+        echo "inline int helper$i(const Node$i& node) { return node.sum(node.get()); }"
+        echo "}"
+    } > $DIR/include/h$i.h
+done
+
+for ((j = 0; j < FILES; j++)); do
+    a=$((j % HEADERS))
+    b=$(((j * 7 + 3) % HEADERS))
+    {
+        echo "#include \"h$a.h\""
+        echo "#include \"h$b.h\""
+        echo "namespace bench {"
+        echo "int file$j(int x) {"
+        echo "    Node$a node;"
+        echo "    node.field = x;"
+        echo "    return helper$a(node) + Chain$b<$DEPTH>::value(x);"
+        echo "}"
+        echo "}"
+    } > $DIR/src/file$j.cpp
+done
@@ -0,0 +1,166 @@
+#!/bin/bash
+# Times clang4vim-index on projects written by generate.sh. Nothing is
+# downloaded and the projects only depend on the settings below, so runs
+# on the same machine can be compared across commits. Every phase is run
+# BENCH_RUNS times on a fresh project and the median is reported.
+#
+# Settings, from the environment:
+#   BENCH_FILES    source files in the project               (200)
+#   BENCH_HEADERS  headers, each including the previous one  (40)
+#   BENCH_DEPTH    template instantiation depth              (16)
+#   BENCH_CHANGED  source files modified before an update    (10)
+#   BENCH_REMOVED  source files removed with rm              (10)
+#   BENCH_JOBS     --jobs for build and update               (1)
+#   BENCH_RUNS     runs per phase                            (3)
+#   BENCH_DIR      scratch directory                         (/tmp/clic-benchmark)
+#   CLIC           the binary to time                        (../clang4vim-index)
+
+FILES=${BENCH_FILES:-200}
+HEADERS=${BENCH_HEADERS:-40}
+DEPTH=${BENCH_DEPTH:-16}
+CHANGED=${BENCH_CHANGED:-10}
+REMOVED=${BENCH_REMOVED:-10}
+JOBS=${BENCH_JOBS:-1}
+RUNS=${BENCH_RUNS:-3}
+WORK=${BENCH_DIR:-/tmp/clic-benchmark}
+
+HERE=`cd $(dirname $0); pwd`
+CLIC=${CLIC:-$HERE/../clang4vim-index}
+CLIC=`cd $(dirname $CLIC); pwd`/`basename $CLIC`
+PROJECT=$WORK/project
+RESULTS=$WORK/results
+
+if [ ! -x $CLIC ]; then
+    echo "ERROR: No clang4vim-index at \`$CLIC'." >&2
+    exit 1
+fi
+
+# Runs a command in the database directory and sets SECS to its wall time.
+# Its output goes to log, the benchmark stops if it fails.
+timed() {
+    local start=`date +%s.%N`
+    "$@" > log 2>&1 || { cat log >&2; echo "ERROR: $* failed." >&2; exit 1; }
+    local end=`date +%s.%N`
+    SECS=`awk "BEGIN { printf \"%.3f\", $end - $start }"`
+}
+
+# Counts the references in the index files of the given source files
+references() {
+    for f in "$@"; do
+        zcat "`echo $f | tr / %`.i.gz"
+    done | awk -F'\t' '{ n += NF - 1 } END { print n + 0 }'
+}
+
+# Index files are written for the files that were (re)indexed, so the ones
+# newer than the marker tell what an update did
+touchMarker() {
+    touch marker
+}
+updatedFiles() {
+    find . -name '*.i.gz' -newer marker | wc -l
+}
+updatedReferences() {
+    find . -name '*.i.gz' -newer marker | xargs -r zcat | awk -F'\t' '{ n += NF - 1 } END { print n + 0 }'
+}
+
+# Prints a result line and keeps it for the medians: phase, files, seconds,
+# references and, if known, the database size
+record() {
+    local line=`awk -v phase=$1 -v files=$2 -v secs=$3 -v refs=$4 -v bytes=$5 'BEGIN {
+        rate = secs > 0 ? 1 / secs : 0
+        printf "%-13s files=%d seconds=%.3f files/s=%.1f refs/s=%.0f", phase, files, secs, files * rate, refs * rate
+        if (bytes != "")
+            printf " bytes/ref=%.1f", refs > 0 ? bytes / refs : 0
+        printf "\n"
+    }'`
+    echo "$line"
+    echo "$line" >> $RESULTS
+}
+
+run() {
+    rm -rf $PROJECT $WORK/db
+    $HERE/generate.sh $PROJECT $FILES $HEADERS $DEPTH || exit 1
+    mkdir -p $WORK/db
+    cd $WORK/db
+    find $PROJECT/src -name '*.cpp' | sort > files.txt
+    OPTIONS="-std=c++11 -I$PROJECT/include"
+
+    # Full build
+    timed $CLIC build --jobs=$JOBS index.db files.txt $OPTIONS
+    local bytes=`ls -l index.db index.db.* 2>/dev/null | awk '{ n += $5 } END { print n }'`
+    record build $FILES $SECS `references $(cat files.txt)` $bytes
+
+    # Update with nothing to do
+    timed $CLIC update --jobs=$JOBS index.db files.txt $OPTIONS
+    record noop-update $FILES $SECS 0
+
+    # Update after modifying source files
+    for f in `head -n $CHANGED files.txt`; do
+        echo "int modified_`basename $f .cpp`;" >> $f
+    done
+    touchMarker
+    timed $CLIC update --jobs=$JOBS index.db files.txt $OPTIONS
+    record update `updatedFiles` $SECS `updatedReferences`
+
+    # Update after modifying the header in the middle of the include chain
+    echo "// modified" >> $PROJECT/include/h$((HEADERS / 2)).h
+    touchMarker
+    timed $CLIC update --jobs=$JOBS index.db files.txt $OPTIONS
+    record header-update `updatedFiles` $SECS `updatedReferences`
+
+    # Removing source files, one rm each
+    local removed=`head -n $REMOVED files.txt`
+    local refs=`references $removed`
+    local total=0
+    for f in $removed; do
+        timed $CLIC rm index.db $f
+        total=`awk "BEGIN { print $total + $SECS }"`
+    done
+    record rm $REMOVED $total $refs
+
+    cd - > /dev/null
+}
+
+mkdir -p $WORK
+rm -f $RESULTS
+echo "files=$FILES headers=$HEADERS depth=$DEPTH jobs=$JOBS runs=$RUNS"
+for ((run = 1; run <= RUNS; run++)); do
+    echo "Run $run"
+    run
+done
+
+# The median of every column over the runs of each phase
+echo "Median"
+awk '{
+    order[$1] = order[$1] ? order[$1] : ++phases
+    for (i = 2; i <= NF; i++) {
+        split($i, kv, "=")
+        key = $1 SUBSEP kv[1]
+        values[key] = values[key] " " kv[2]
+        if (!((kv[1]) in seen)) {
+            seen[kv[1]] = 1
+            columns[++ncolumns] = kv[1]
+        }
+    }
+}
+END {
+    for (p = 1; p <= phases; p++) {
+        for (name in order)
+            if (order[name] == p)
+                break
+        line = sprintf("%-13s", name)
+        for (c = 1; c <= ncolumns; c++) {
+            key = name SUBSEP columns[c]
+            if (!(key in values))
+                continue
+            n = split(values[key], v, " ")
+            # Insertion sort, there are only a few runs
+            for (i = 2; i <= n; i++)
+                for (j = i; j > 1 && v[j - 1] + 0 > v[j] + 0; j--) {
+                    t = v[j]; v[j] = v[j - 1]; v[j - 1] = t
+                }
+            line = line " " columns[c] "=" v[int((n + 1) / 2)]
+        }
+        print line
+    }
+}' $RESULTS
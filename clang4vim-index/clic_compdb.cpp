@@ -0,0 +1,289 @@
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+
+#include <stdint.h>
+
+#include "clic_compdb.h"
+
+namespace {
+
+// Just enough JSON for compilation databases: the values that are not
+// needed are checked and skipped.
+class JsonReader {
+public:
+    JsonReader(const char* p, const char* end) : p(p), end(end) {}
+
+    bool consume(char c) {
+        skipSpace();
+        if (p == end || *p != c)
+            return false;
+        ++p;
+        return true;
+    }
+
+    // Calls member for every key of an object, which must read the value
+    bool readObject(const std::function<bool(const std::string& key)>& member) {
+        if (!consume('{'))
+            return false;
+        if (consume('}'))
+            return true;
+        do {
+            std::string key;
+            if (!readString(key) || !consume(':') || !member(key))
+                return false;
+        } while (consume(','));
+        return consume('}');
+    }
+
+    // Calls element for every element of an array, which must read it
+    bool readArray(const std::function<bool()>& element) {
+        if (!consume('['))
+            return false;
+        if (consume(']'))
+            return true;
+        do {
+            if (!element())
+                return false;
+        } while (consume(','));
+        return consume(']');
+    }
+
+    bool readString(std::string& out) {
+        out.clear();
+        if (!consume('"'))
+            return false;
+        while (p != end && *p != '"') {
+            char c = *p++;
+            if (static_cast<unsigned char>(c) < 0x20)
+                return false;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (p == end)
+                return false;
+            switch (c = *p++) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t code;
+                if (!readHex(code))
+                    return false;
+                // A surrogate pair encodes one code point
+                if (code >= 0xd800 && code < 0xdc00) {
+                    uint32_t low;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                        return false;
+                    p += 2;
+                    if (!readHex(low) || low < 0xdc00 || low >= 0xe000)
+                        return false;
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                appendUtf8(out, code);
+                break;
+            }
+            default:
+                out += c;
+            }
+        }
+        return p++ != end;
+    }
+
+    bool skipValue() {
+        skipSpace();
+        if (p == end)
+            return false;
+        std::string str;
+        switch (*p) {
+        case '{':
+            return readObject([&](const std::string&) { return skipValue(); });
+        case '[':
+            return readArray([&]() { return skipValue(); });
+        case '"':
+            return readString(str);
+        default: {
+            // A number or literal
+            const char* start = p;
+            while (p != end && (isalnum(static_cast<unsigned char>(*p))
+                                || *p == '-' || *p == '+' || *p == '.'))
+                ++p;
+            return p != start;
+        }
+        }
+    }
+
+    bool atEnd() {
+        skipSpace();
+        return p == end;
+    }
+
+private:
+    void skipSpace() {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            ++p;
+    }
+
+    bool readHex(uint32_t& code) {
+        if (end - p < 4)
+            return false;
+        code = 0;
+        for (int i = 0; i != 4; ++i) {
+            char c = *p++;
+            int digit = c >= '0' && c <= '9' ? c - '0'
+                      : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0)
+                return false;
+            code = code << 4 | digit;
+        }
+        return true;
+    }
+
+    static void appendUtf8(std::string& out, uint32_t code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xc0 | code >> 6);
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xe0 | code >> 12);
+            out += static_cast<char>(0x80 | (code >> 6 & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | code >> 18);
+            out += static_cast<char>(0x80 | (code >> 12 & 0x3f));
+            out += static_cast<char>(0x80 | (code >> 6 & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+    }
+
+    const char* p;
+    const char* end;
+};
+
+// Splits a command line the way a POSIX shell would, without expansions
+std::vector<std::string> splitCommand(const std::string& command) {
+    std::vector<std::string> words;
+    std::string word;
+    bool inWord = false;
+    for (std::string::size_type i = 0; i != command.size(); ++i) {
+        char c = command[i];
+        if (c == ' ' || c == '\t' || c == '\n') {
+            if (inWord)
+                words.push_back(word);
+            word.clear();
+            inWord = false;
+            continue;
+        }
+        inWord = true;
+        if (c == '\\' && i + 1 != command.size()) {
+            word += command[++i];
+        } else if (c == '\'') {
+            while (++i != command.size() && command[i] != '\'')
+                word += command[i];
+        } else if (c == '"') {
+            while (++i != command.size() && command[i] != '"') {
+                if (command[i] == '\\' && i + 1 != command.size()
+                        && (command[i + 1] == '"' || command[i + 1] == '\\'))
+                    ++i;
+                word += command[i];
+            }
+        } else {
+            word += c;
+        }
+    }
+    if (inWord)
+        words.push_back(word);
+    return words;
+}
+
+// Drops what does not affect parsing or would make libclang write files
+std::vector<std::string> parsingOptions(const std::vector<std::string>& arguments,
+                                        const std::string& file,
+                                        const std::string& filename) {
+    static const char* const withValue[] = {"-MF", "-MT", "-MQ"};
+    static const char* const alone[] = {"-c", "-M", "-MM", "-MD", "-MMD", "-MP"};
+
+    std::vector<std::string> options;
+    for (size_t i = 1; i < arguments.size(); ++i) {
+        const std::string& arg = arguments[i];
+        if (arg == file || arg == filename)
+            continue;
+        bool skip = false;
+        if (arg == "-o") {
+            ++i;
+            skip = true;
+        }
+        for (const char* option : withValue) {
+            if (arg == option) {
+                ++i;
+                skip = true;
+            } else if (arg.compare(0, strlen(option), option) == 0) {
+                skip = true;
+            }
+        }
+        for (const char* option : alone)
+            skip |= arg == option;
+        if (!skip)
+            options.push_back(arg);
+    }
+    return options;
+}
+
+} // namespace
+
+bool readCompileCommands(const std::string& compdbFilename,
+                         std::vector<ClicCompileCommand>& commands) {
+    std::ifstream in(compdbFilename.c_str(), std::ios::binary);
+    if (!in.good()) {
+        std::cerr << "ERROR: Opening file `" << compdbFilename << "'.\n";
+        return false;
+    }
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    JsonReader reader(json.data(), json.data() + json.size());
+    bool ok = reader.readArray([&]() {
+        std::string directory, file, command, argument;
+        std::vector<std::string> arguments;
+        bool parsed = reader.readObject([&](const std::string& key) {
+            if (key == "directory")
+                return reader.readString(directory);
+            if (key == "file")
+                return reader.readString(file);
+            if (key == "command")
+                return reader.readString(command);
+            if (key == "arguments") {
+                return reader.readArray([&]() {
+                    if (!reader.readString(argument))
+                        return false;
+                    arguments.push_back(argument);
+                    return true;
+                });
+            }
+            return reader.skipValue();
+        });
+        if (!parsed || directory.empty() || file.empty())
+            return false;
+
+        if (arguments.empty())
+            arguments = splitCommand(command);
+        ClicCompileCommand entry;
+        entry.filename = file[0] == '/' ? file : directory + "/" + file;
+        entry.options.push_back("-working-directory=" + directory);
+        for (const auto &option : parsingOptions(arguments, file, entry.filename))
+            entry.options.push_back(option);
+        commands.push_back(entry);
+        return true;
+    }) && reader.atEnd();
+
+    if (!ok)
+        std::cerr << "ERROR: `" << compdbFilename << "' is not a compilation database.\n";
+    return ok;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// One entry of a compile_commands.json
+struct ClicCompileCommand {
+    // Absolute path of the source file
+    std::string filename;
+    // The compiler options that matter for parsing: the compiler, the
+    // source file and the outputs are dropped, and -working-directory
+    // makes relative paths resolve like they do for the build.
+    std::vector<std::string> options;
+};
+
+// Reads a JSON compilation database. Every entry needs "directory",
+// "file" and either "arguments" or a shell quoted "command".
+bool readCompileCommands(const std::string& compdbFilename,
+                         std::vector<ClicCompileCommand>& commands);
@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "clic_daemon.h"
+#include "clic_printer.h"
+
+ClicDaemon::ClicDaemon(const char* dbFilename, const ClicDbOptions& dbOptions,
+                       const IndexerOptions& indexerOptions)
+    : indexerOptions(indexerOptions), cxindex(clang_createIndex(0, 0)),
+      db(dbFilename, dbOptions), running(true) {}
+
+ClicDaemon::~ClicDaemon() {
+    for (auto &it : residents)
+        clang_disposeTranslationUnit(it.second.tu);
+    clang_disposeIndex(cxindex);
+}
+
+void ClicDaemon::dropResident(const std::string& sourceFilename) {
+    auto it = residents.find(sourceFilename);
+    if (it == residents.end())
+        return;
+    clang_disposeTranslationUnit(it->second.tu);
+    residents.erase(it);
+    residentsByAge.remove(sourceFilename);
+}
+
+int ClicDaemon::run(const char* socketPath) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        std::cerr << "ERROR: Socket path `" << socketPath << "' is too long.\n";
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (listenFd < 0
+            || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0
+            || listen(listenFd, 16) != 0) {
+        std::cerr << "ERROR: Listening on `" << socketPath << "': "
+                  << strerror(errno) << "\n";
+        return 1;
+    }
+
+    // A client hanging up early must not take the daemon down
+    signal(SIGPIPE, SIG_IGN);
+
+    // One thread serves every client, as it owns the database and the
+    // resident units. A client waiting for its answers to be read is not
+    // read from until they are.
+    std::vector<Client> clients;
+    std::vector<pollfd> fds;
+    bool failed = false;
+    while (running && !failed) {
+        fds.clear();
+        fds.push_back(pollfd{listenFd, POLLIN, 0});
+        for (const auto &client : clients) {
+            short events = client.written != client.output.size() ? POLLOUT : POLLIN;
+            fds.push_back(pollfd{client.fd, events, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "ERROR: poll: " << strerror(errno) << "\n";
+            break;
+        }
+
+        for (size_t i = 1; i != fds.size() && running; ++i) {
+            Client& client = clients[i - 1];
+            if (!fds[i].revents)
+                continue;
+            bool open = fds[i].events == POLLOUT ? flush(client) : receive(client);
+            if (!open) {
+                close(client.fd);
+                client.fd = -1;
+            }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                     [](const Client& client) { return client.fd < 0; }),
+                      clients.end());
+
+        if (running && (fds[0].revents & POLLIN)) {
+            int fd = accept(listenFd, NULL, NULL);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                clients.push_back(Client{fd, "", "", 0, false});
+            } else if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+                std::cerr << "ERROR: accept: " << strerror(errno) << "\n";
+                failed = true;
+            }
+        }
+    }
+
+    // The client that asked for the shutdown gets its answer
+    for (auto &client : clients) {
+        if (client.fd < 0)
+            continue;
+        flush(client);
+        close(client.fd);
+    }
+    close(listenFd);
+    unlink(socketPath);
+    return running ? 1 : 0;
+}
+
+bool ClicDaemon::receive(Client& client) {
+    char chunk[4096];
+    ssize_t n = read(client.fd, chunk, sizeof(chunk));
+    if (n < 0)
+        return errno == EINTR || errno == EAGAIN;
+    if (n == 0)
+        client.hungUp = true;
+    client.input.append(chunk, n);
+
+    std::string::size_type start = 0;
+    for (std::string::size_type eol;
+            running && (eol = client.input.find('\n', start)) != std::string::npos;
+            start = eol + 1) {
+        std::string line = client.input.substr(start, eol - start);
+
+        std::vector<std::string> request;
+        for (const auto &word : split(line, '\t'))
+            if (!word.empty())
+                request.push_back(word);
+        if (request.empty())
+            continue;
+
+        std::stringstream out;
+        if (handle(request, out))
+            out << "OK\n";
+        client.output += out.str();
+    }
+    client.input.erase(0, start);
+    return flush(client);
+}
+
+bool ClicDaemon::flush(Client& client) {
+    while (client.written != client.output.size()) {
+        ssize_t n = write(client.fd, client.output.data() + client.written,
+                          client.output.size() - client.written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return true;
+        if (n <= 0)
+            return false;
+        client.written += n;
+    }
+    client.output.clear();
+    client.written = 0;
+    return !client.hungUp;
+}
+
+bool ClicDaemon::handle(const std::vector<std::string>& request, std::ostream& out) {
+    const std::string& cmd = request[0];
+
+    if (cmd == "add")
+        return add(request, out);
+
+    if (cmd == "rm")
+        return rm(request, out);
+
+    if (cmd == "query")
+        return query(request, out);
+
+    if (cmd == "names")
+        return names(request, out);
+
+    if (cmd == "shutdown") {
+        running = false;
+        return true;
+    }
+
+    out << "ERROR Unknown request `" << cmd << "'\n";
+    return false;
+}
+
+bool ClicDaemon::add(const std::vector<std::string>& request, std::ostream& out) {
+    if (request.size() < 3) {
+        out << "ERROR Usage: add <indexFilename> [<options>] <sourceFilename>\n";
+        return false;
+    }
+
+    const std::string& indexFilename = request[1];
+    const std::string& sourceFilename = request.back();
+    std::vector<std::string> args(request.begin() + 2, request.end());
+    std::vector<const char*> argv;
+    for (const auto &arg : args)
+        argv.push_back(arg.c_str());
+
+    // Find out what the file contributed so far and try to reuse its unit
+    ClicFlatIndex oldIndex;
+    CXTranslationUnit tu = NULL;
+    auto resident = residents.find(sourceFilename);
+    if (resident != residents.end()) {
+        oldIndex = std::move(resident->second.index);
+        if (resident->second.args == args && reparseTranslationUnit(resident->second.tu))
+            tu = resident->second.tu;
+        else
+            clang_disposeTranslationUnit(resident->second.tu);
+        residents.erase(resident);
+        residentsByAge.remove(sourceFilename);
+    } else {
+        db.fileIndex(sourceFilename, oldIndex);
+    }
+
+    if (!tu) {
+        tu = parseTranslationUnit(cxindex, argv.data(), argv.size(),
+                clang_defaultEditingTranslationUnitOptions()
+                | CXTranslationUnit_PrecompiledPreamble
+                | CXTranslationUnit_CreatePreambleOnFirstParse);
+    }
+    if (!tu) {
+        out << "ERROR Could not parse `" << sourceFilename << "'\n";
+        return false;
+    }
+
+    ClicFlatIndex index;
+    indexParsedTranslationUnit(cxindex, tu, argv.back(), index, indexerOptions);
+    if (!writeIndexFile(indexFilename, index)) {
+        clang_disposeTranslationUnit(tu);
+        out << "ERROR Could not write `" << indexFilename << "'\n";
+        return false;
+    }
+
+    ClicFlatIndex removed, added;
+    diffIndex(oldIndex, index, removed, added);
+    db.transaction([&]() {
+        db.rmIndex(removed, sourceFilename);
+        db.addIndex(added, sourceFilename);
+    });
+
+    ResidentUnit& unit = residents[sourceFilename];
+    unit.args.swap(args);
+    unit.tu = tu;
+    unit.index = std::move(index);
+    residentsByAge.push_back(sourceFilename);
+    if (residentsByAge.size() > maxResidentUnits)
+        dropResident(residentsByAge.front());
+    return true;
+}
+
+bool ClicDaemon::rm(const std::vector<std::string>& request, std::ostream& out) {
+    if (request.size() != 2) {
+        out << "ERROR Usage: rm <sourceFilename>\n";
+        return false;
+    }
+
+    dropResident(request[1]);
+
+    if (!db.rmFile(request[1])) {
+        out << "ERROR `" << request[1] << "' is not indexed\n";
+        return false;
+    }
+    return true;
+}
+
+bool ClicDaemon::query(const std::vector<std::string>& request, std::ostream& out) {
+    bool prefix = request.size() == 3 && request[1] == "--prefix";
+    if (request.size() != 2 && !prefix) {
+        out << "ERROR Usage: query [--prefix] <usr>\n";
+        return false;
+    }
+
+    if (prefix) {
+        db.forEachLocationWithPrefix(request[2],
+                [&](const std::string& usr, const std::string& location) {
+                    out << usr << '\t' << location << '\n';
+                });
+    } else {
+        db.forEachLocation(request[1],
+                [&](const std::string&, const std::string& location) {
+                    out << location << '\n';
+                });
+    }
+    return true;
+}
+
+bool ClicDaemon::names(const std::vector<std::string>& request, std::ostream& out) {
+    bool substring = request.size() == 3 && request[1] == "--substring";
+    if (request.size() != 2 && !substring) {
+        out << "ERROR Usage: names [--substring] <name>\n";
+        return false;
+    }
+
+    db.findNames(request.back(), substring,
+            [&](const std::string& name, const std::string& usr, uint32_t kind) {
+                out << name << '\t' << cursorKindSpelling(kind) << '\t' << usr << '\n';
+            });
+    return true;
+}
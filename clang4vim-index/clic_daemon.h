@@ -0,0 +1,82 @@
+#pragma once
+
+extern "C" {
+#include <clang-c/Index.h>
+}
+
+#include <list>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ClicDb.h"
+#include "clic_indexer.h"
+
+// Keeps the CXIndex and the database open and serves requests over a Unix
+// socket. A client sends one request per line, with the same arguments as
+// the corresponding command line subcommand minus the database, separated
+// by tabs so that paths and options may contain spaces:
+//
+//   add <indexFilename> [<options>] <sourceFilename>
+//   rm <sourceFilename>
+//   query [--prefix] <usr>
+//   names [--substring] <name>
+//   shutdown
+//
+// Every request is answered with zero or more result lines followed by a
+// line holding either "OK" or "ERROR <message>". Several clients can stay
+// connected at once; their requests are handled one at a time.
+//
+// add replaces the previous contribution of the file. The most recently
+// added translation units stay parsed, so adding one of them again only
+// reparses it on top of its precompiled preamble and writes the
+// references that changed.
+class ClicDaemon {
+public:
+    ClicDaemon(const char* dbFilename, const ClicDbOptions& dbOptions,
+               const IndexerOptions& indexerOptions);
+    ~ClicDaemon();
+
+    int run(const char* socketPath);
+
+private:
+    struct Client {
+        int fd;
+        std::string input;
+        std::string output;
+        // The part of output the client has been sent
+        size_t written;
+        bool hungUp;
+    };
+
+    // Reads what the client sent and answers the requests it completed,
+    // and writes what the client can take without blocking. Both return
+    // false once the client is to be closed.
+    bool receive(Client& client);
+    bool flush(Client& client);
+    bool handle(const std::vector<std::string>& request, std::ostream& out);
+
+    bool add(const std::vector<std::string>& request, std::ostream& out);
+    bool rm(const std::vector<std::string>& request, std::ostream& out);
+    bool query(const std::vector<std::string>& request, std::ostream& out);
+    bool names(const std::vector<std::string>& request, std::ostream& out);
+
+    struct ResidentUnit {
+        std::vector<std::string> args;
+        CXTranslationUnit tu;
+        ClicFlatIndex index;
+    };
+
+    static const size_t maxResidentUnits = 32;
+
+    void dropResident(const std::string& sourceFilename);
+
+    IndexerOptions indexerOptions;
+    CXIndex cxindex;
+    ClicDb db;
+    bool running;
+
+    std::map<std::string, ResidentUnit> residents;
+    std::list<std::string> residentsByAge;
+};
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <tuple>
+
+#include "clic_flat_index.h"
+
+size_t StringPool::Hash::operator()(const StringRef& ref) const {
+    // 32 bit FNV-1a is plenty for a hash table
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i != ref.size; ++i) {
+        hash ^= static_cast<unsigned char>(ref.data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+char* StringPool::allocate(size_t size) {
+    // Large strings get a block of their own
+    if (size > blockSize / 4) {
+        blocks.emplace_back(new char[size]);
+        return blocks.back().get();
+    }
+    if (size > blockSize - used) {
+        blocks.emplace_back(new char[blockSize]);
+        current = blocks.back().get();
+        used = 0;
+    }
+    char* res = current + used;
+    used += size;
+    return res;
+}
+
+uint32_t StringPool::intern(const char* data, size_t size) {
+    auto found = ids.find(StringRef(data, size));
+    if (found != ids.end())
+        return found->second;
+
+    char* copy = allocate(size);
+    memcpy(copy, data, size);
+
+    uint32_t id = strings.size();
+    strings.push_back(StringRef(copy, size));
+    ids.insert(std::make_pair(strings.back(), id));
+    return id;
+}
+
+void StringPool::clear() {
+    blocks.clear();
+    current = NULL;
+    used = blockSize;
+    strings.clear();
+    ids.clear();
+}
+
+namespace {
+
+// Maps every id of a pool to its position in string order, so references
+// can be sorted by comparing integers.
+std::vector<uint32_t> rankStrings(const ClicFlatIndex& index, size_t count,
+                                  StringRef (ClicFlatIndex::*str)(uint32_t) const) {
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i != count; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return (index.*str)(a) < (index.*str)(b);
+    });
+
+    std::vector<uint32_t> rank(count);
+    for (uint32_t i = 0; i != count; ++i)
+        rank[order[i]] = i;
+    return rank;
+}
+
+} // namespace
+
+void ClicFlatIndex::finalize() {
+    if (sorted)
+        return;
+
+    std::vector<uint32_t> usrRank = rankStrings(*this, usrs.size(), &ClicFlatIndex::usr);
+    std::vector<uint32_t> fileRank = rankStrings(*this, files.size(), &ClicFlatIndex::file);
+    auto key = [&](const Reference& ref) {
+        return std::make_tuple(usrRank[ref.usr], fileRank[ref.file], ref.line, ref.column, ref.kind);
+    };
+
+    std::sort(refs.begin(), refs.end(), [&](const Reference& a, const Reference& b) {
+        return key(a) < key(b);
+    });
+    refs.erase(std::unique(refs.begin(), refs.end(), [&](const Reference& a, const Reference& b) {
+        return key(a) == key(b);
+    }), refs.end());
+    sorted = true;
+}
+
+void ClicFlatIndex::setName(uint32_t usr, const char* data, size_t size, uint32_t kind) {
+    if (hasName(usr))
+        return;
+    if (usr >= names.size()) {
+        Name none = {noName, 0};
+        names.resize(usr + 1, none);
+    }
+    names[usr].spelling = spellings.intern(data, size);
+    names[usr].kind = kind;
+}
+
+bool ClicFlatIndex::name(uint32_t usr, StringRef& spelling, uint32_t& kind) const {
+    if (!hasName(usr))
+        return false;
+    spelling = spellings.str(names[usr].spelling);
+    kind = names[usr].kind;
+    return true;
+}
+
+void ClicFlatIndex::clear() {
+    usrs.clear();
+    files.clear();
+    spellings.clear();
+    names.clear();
+    refs.clear();
+    sorted = true;
+}
+
+namespace {
+
+int compareReferences(const ClicFlatIndex& a, const ClicFlatIndex::Reference& ra,
+                      const ClicFlatIndex& b, const ClicFlatIndex::Reference& rb) {
+    int res = a.usr(ra.usr).compare(b.usr(rb.usr));
+    if (res == 0)
+        res = a.file(ra.file).compare(b.file(rb.file));
+    if (res != 0)
+        return res;
+    auto ta = std::make_tuple(ra.line, ra.column, ra.kind);
+    auto tb = std::make_tuple(rb.line, rb.column, rb.kind);
+    return ta < tb ? -1 : tb < ta ? 1 : 0;
+}
+
+void copyReference(const ClicFlatIndex& from, const ClicFlatIndex::Reference& ref,
+                   ClicFlatIndex& to) {
+    StringRef usr = from.usr(ref.usr);
+    StringRef file = from.file(ref.file);
+    uint32_t usrId = to.internUsr(usr.data, usr.size);
+    to.add(usrId, to.internFile(file.data, file.size), ref.line, ref.column, ref.kind);
+
+    StringRef spelling;
+    uint32_t kind;
+    if (!to.hasName(usrId) && from.name(ref.usr, spelling, kind))
+        to.setName(usrId, spelling.data, spelling.size, kind);
+}
+
+} // namespace
+
+void appendIndex(const ClicFlatIndex& from, ClicFlatIndex& to) {
+    for (const auto &ref : from.references())
+        copyReference(from, ref, to);
+}
+
+void diffIndex(const ClicFlatIndex& from, const ClicFlatIndex& to,
+               ClicFlatIndex& removed, ClicFlatIndex& added) {
+    const auto& f = from.references();
+    const auto& t = to.references();
+    size_t i = 0, j = 0;
+
+    while (i != f.size() || j != t.size()) {
+        int cmp = i == f.size() ? 1 : j == t.size() ? -1
+                : compareReferences(from, f[i], to, t[j]);
+        if (cmp < 0)
+            copyReference(from, f[i++], removed);
+        else if (cmp > 0)
+            copyReference(to, t[j++], added);
+        else
+            ++i, ++j;
+    }
+    removed.finalize();
+    added.finalize();
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+// Interns strings into an append-only arena. Ids are dense, and the bytes
+// of an interned string never move.
+class StringPool {
+public:
+    StringPool() : current(NULL), used(blockSize) {}
+
+    uint32_t intern(const char* data, size_t size);
+    StringRef str(uint32_t id) const { return strings[id]; }
+    size_t size() const { return strings.size(); }
+    void clear();
+
+private:
+    struct Hash {
+        size_t operator()(const StringRef& ref) const;
+    };
+
+    static const size_t blockSize = 64 * 1024;
+
+    char* allocate(size_t size);
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* current;
+    size_t used;
+    std::vector<StringRef> strings;
+    std::unordered_map<StringRef, uint32_t, Hash> ids;
+};
+
+// The references of one or more translation units. They are appended as
+// they are found, and finalize() sorts them by USR and location and drops
+// duplicates once at the end. The spelling and cursor kind of the entity
+// behind a USR can be recorded alongside, once per USR.
+class ClicFlatIndex {
+public:
+    struct Reference {
+        uint32_t usr;
+        uint32_t file;
+        uint32_t line;
+        uint32_t column;
+        uint32_t kind;
+    };
+
+    ClicFlatIndex() : sorted(true) {}
+
+    uint32_t internUsr(const char* data, size_t size) { return usrs.intern(data, size); }
+    uint32_t internFile(const char* data, size_t size) { return files.intern(data, size); }
+    void add(uint32_t usr, uint32_t file, uint32_t line, uint32_t column, uint32_t kind) {
+        Reference ref = {usr, file, line, column, kind};
+        refs.push_back(ref);
+        sorted = false;
+    }
+
+    bool hasName(uint32_t usr) const {
+        return usr < names.size() && names[usr].spelling != noName;
+    }
+    void setName(uint32_t usr, const char* data, size_t size, uint32_t kind);
+    bool name(uint32_t usr, StringRef& spelling, uint32_t& kind) const;
+
+    void finalize();
+    void clear();
+
+    bool empty() const { return refs.empty(); }
+    size_t size() const { return refs.size(); }
+    const std::vector<Reference>& references() const { return refs; }
+    StringRef usr(uint32_t id) const { return usrs.str(id); }
+    StringRef file(uint32_t id) const { return files.str(id); }
+    size_t fileCount() const { return files.size(); }
+    size_t usrCount() const { return usrs.size(); }
+
+private:
+    struct Name {
+        uint32_t spelling;
+        uint32_t kind;
+    };
+
+    static const uint32_t noName = ~0u;
+
+    StringPool usrs;
+    StringPool files;
+    StringPool spellings;
+    std::vector<Reference> refs;
+    // By USR id
+    std::vector<Name> names;
+    bool sorted;
+};
+
+// Adds the references and names of from to to, which is left to be
+// finalized.
+void appendIndex(const ClicFlatIndex& from, ClicFlatIndex& to);
+
+// Splits the difference between two indexes of the same file into the
+// references that disappeared and the ones that are new. Both indexes must
+// be finalized.
+void diffIndex(const ClicFlatIndex& from, const ClicFlatIndex& to,
+               ClicFlatIndex& removed, ClicFlatIndex& added);
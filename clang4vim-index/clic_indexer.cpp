@@ -0,0 +1,353 @@
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "clic_indexer.h"
+#include "clic_stats.h"
+
+static bool belowDirectory(const std::string& path, const std::string& directory) {
+    return path.compare(0, directory.size(), directory) == 0
+        && (path.size() == directory.size() || path[directory.size()] == '/'
+            || (!directory.empty() && directory.back() == '/'));
+}
+
+ClicFileFilter::ClicFileFilter(const IndexerOptions& options)
+    : options(options),
+      active(options.skipSystemHeaders || !options.includePaths.empty()
+             || !options.excludePaths.empty()) {}
+
+bool ClicFileFilter::decide(CXFile file, CXSourceLocation location) {
+    if (options.skipSystemHeaders && clang_Location_isInSystemHeader(location))
+        return true;
+    if (options.includePaths.empty() && options.excludePaths.empty())
+        return false;
+
+    CXString name = clang_getFileName(file);
+    const char* str = clang_getCString(name);
+    std::string path = str ? str : "";
+    clang_disposeString(name);
+    // clang keeps the ../ and symbolic links of include paths, while the
+    // directories of the options are resolved
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved))
+        path = resolved;
+
+    for (const auto &directory : options.excludePaths)
+        if (belowDirectory(path, directory))
+            return true;
+    if (options.includePaths.empty())
+        return false;
+    for (const auto &directory : options.includePaths)
+        if (belowDirectory(path, directory))
+            return false;
+    return true;
+}
+
+enum CXChildVisitResult EverythingIndexer::visit(CXCursor cursor, CXCursor parent) {
+    ++cursorsVisited;
+    CXFile file;
+    unsigned int line, column, offset;
+    CXSourceLocation location = clang_getCursorLocation(cursor);
+    clang_getInstantiationLocation(location, &file, &line, &column, &offset);
+    if (file && filter.skip(file, location))
+        return CXChildVisit_Continue;
+    CXCursorKind kind = clang_getCursorKind(cursor);
+    CXString cursorFilename = clang_getFileName(file);
+
+    if (!cursorFilename.data || translationUnitFilename == clang_getCString(cursorFilename)) {
+        clang_disposeString(cursorFilename);
+        return CXChildVisit_Continue;
+    }
+
+    CXCursor refCursor = clang_getCursorReferenced(cursor);
+    if (!clang_equalCursors(refCursor, clang_getNullCursor())) {
+        CXFile refFile;
+        unsigned int refLine, refColumn, refOffset;
+        clang_getInstantiationLocation(
+                clang_getCursorLocation(refCursor),
+                &refFile, &refLine, &refColumn, &refOffset);
+
+        if (refFile) {
+            CXString refUsr = clang_getCursorUSR(refCursor);
+            const char* referencedUsr = clang_getCString(refUsr);
+            if (*referencedUsr) {
+                const char* filename = clang_getCString(cursorFilename);
+                uint32_t usr = usrToReferences.internUsr(referencedUsr, strlen(referencedUsr));
+                usrToReferences.add(usr,
+                        usrToReferences.internFile(filename, strlen(filename)),
+                        line, column, kind);
+
+                if (!usrToReferences.hasName(usr)) {
+                    CXString spelling = clang_getCursorSpelling(refCursor);
+                    const char* name = clang_getCString(spelling);
+                    if (name && *name)
+                        usrToReferences.setName(usr, name, strlen(name),
+                                                clang_getCursorKind(refCursor));
+                    clang_disposeString(spelling);
+                }
+            }
+            clang_disposeString(refUsr);
+        }
+    }
+    clang_disposeString(cursorFilename);
+    return CXChildVisit_Recurse;
+}
+
+enum CXChildVisitResult visitorFunction(
+        CXCursor cursor,
+        CXCursor parent,
+        CXClientData clientData)
+{
+    IVisitor* visitor = (IVisitor*)clientData;
+    return visitor->visit(cursor, parent);
+}
+
+static void printDiagnostic(CXDiagnostic diag) {
+    CXString string = clang_formatDiagnostic(diag, clang_defaultDiagnosticDisplayOptions());
+    fprintf(stderr, "%s\n", clang_getCString(string));
+    clang_disposeString(string);
+}
+
+static void printDiagnostics(CXTranslationUnit tu) {
+    int n = clang_getNumDiagnostics(tu);
+    for (int i = 0; i != n; ++i) {
+        CXDiagnostic diag = clang_getDiagnostic(tu, i);
+        printDiagnostic(diag);
+        clang_disposeDiagnostic(diag);
+    }
+}
+
+bool CallbacksIndexer::indexSourceFile(CXIndex cxindex, const char* const* args, int nargs) {
+    printDiagnostics = true;
+    int result = run(cxindex, args, nargs, NULL);
+    if (result != 0)
+        fprintf(stderr, "ERROR: Could not parse `%s'.\n", args[nargs-1]);
+    return result == 0;
+}
+
+void CallbacksIndexer::indexTranslationUnit(CXIndex cxindex, CXTranslationUnit tu) {
+    // The diagnostics were printed when the unit was parsed
+    printDiagnostics = false;
+    run(cxindex, NULL, 0, tu);
+}
+
+int CallbacksIndexer::run(CXIndex cxindex, const char* const* args, int nargs,
+                          CXTranslationUnit tu) {
+    IndexerCallbacks callbacks = {};
+    callbacks.diagnostic = &CallbacksIndexer::diagnostic;
+    callbacks.enteredMainFile = &CallbacksIndexer::enteredMainFile;
+    callbacks.ppIncludedFile = &CallbacksIndexer::includedFile;
+    callbacks.indexDeclaration = &CallbacksIndexer::declaration;
+    callbacks.indexEntityReference = &CallbacksIndexer::reference;
+
+    // Function local symbols have USRs too and the AST visitor records them
+    unsigned options = CXIndexOpt_IndexFunctionLocalSymbols;
+
+    mainFile = NULL;
+    int result;
+    CXIndexAction action = clang_IndexAction_create(cxindex);
+    if (tu)
+        result = clang_indexTranslationUnit(action, this, &callbacks, sizeof(callbacks),
+                                            options, tu);
+    else
+        result = clang_indexSourceFile(action, this, &callbacks, sizeof(callbacks),
+                                       options, 0, args, nargs, 0, 0, 0,
+                                       CXTranslationUnit_None);
+    clang_IndexAction_dispose(action);
+    return result;
+}
+
+void CallbacksIndexer::diagnostic(CXClientData clientData, CXDiagnosticSet diagnostics, void*) {
+    CallbacksIndexer* self = (CallbacksIndexer*)clientData;
+    if (!self->printDiagnostics)
+        return;
+    unsigned n = clang_getNumDiagnosticsInSet(diagnostics);
+    for (unsigned i = 0; i != n; ++i) {
+        CXDiagnostic diag = clang_getDiagnosticInSet(diagnostics, i);
+        printDiagnostic(diag);
+        clang_disposeDiagnostic(diag);
+    }
+}
+
+CXIdxClientFile CallbacksIndexer::enteredMainFile(CXClientData clientData, CXFile mainFile, void*) {
+    CallbacksIndexer* self = (CallbacksIndexer*)clientData;
+    self->mainFile = mainFile;
+    return NULL;
+}
+
+CXIdxClientFile CallbacksIndexer::includedFile(CXClientData clientData, const CXIdxIncludedFileInfo* info) {
+    CallbacksIndexer* self = (CallbacksIndexer*)clientData;
+    uint32_t file = self->fileId(info->file);
+    if (self->includes && file != noFile)
+        self->includes->insert(self->index.file(file).str());
+    return NULL;
+}
+
+void CallbacksIndexer::declaration(CXClientData clientData, const CXIdxDeclInfo* info) {
+    CallbacksIndexer* self = (CallbacksIndexer*)clientData;
+    ++self->entities;
+    self->record(info->loc, clang_getCursorKind(info->cursor), info->entityInfo);
+}
+
+void CallbacksIndexer::reference(CXClientData clientData, const CXIdxEntityRefInfo* info) {
+    CallbacksIndexer* self = (CallbacksIndexer*)clientData;
+    ++self->entities;
+    self->record(info->loc, clang_getCursorKind(info->cursor), info->referencedEntity);
+}
+
+uint32_t CallbacksIndexer::fileId(CXFile file) {
+    if (!file)
+        return noFile;
+
+    auto cached = fileIds.find(file);
+    if (cached == fileIds.end()) {
+        CXString name = clang_getFileName(file);
+        const char* str = clang_getCString(name);
+        uint32_t id = str && *str ? index.internFile(str, strlen(str)) : noFile;
+        clang_disposeString(name);
+        cached = fileIds.insert(std::make_pair(file, id)).first;
+    }
+    return cached->second;
+}
+
+void CallbacksIndexer::record(CXIdxLoc loc, CXCursorKind kind, const CXIdxEntityInfo* entity) {
+    if (!entity || !entity->USR || !*entity->USR)
+        return;
+
+    CXFile file;
+    unsigned line, column, offset;
+    clang_indexLoc_getFileLocation(loc, NULL, &file, &line, &column, &offset);
+    if (file == mainFile)
+        return;
+    uint32_t fileIndex = fileId(file);
+    if (fileIndex == noFile || filter.skip(file, clang_indexLoc_getCXSourceLocation(loc)))
+        return;
+
+    // Like the AST visitor, skip entities that are not declared in a file
+    CXFile refFile;
+    clang_getInstantiationLocation(clang_getCursorLocation(entity->cursor),
+                                   &refFile, NULL, NULL, NULL);
+    if (!refFile)
+        return;
+
+    uint32_t usr = index.internUsr(entity->USR, strlen(entity->USR));
+    index.add(usr, fileIndex, line, column, kind);
+    if (entity->name && *entity->name)
+        index.setName(usr, entity->name, strlen(entity->name),
+                      clang_getCursorKind(entity->cursor));
+}
+
+static void inclusionVisitor(
+        CXFile includedFile,
+        CXSourceLocation* inclusionStack,
+        unsigned includeLen,
+        CXClientData clientData)
+{
+    // The main file is reported with an empty inclusion stack
+    if (includeLen == 0)
+        return;
+
+    std::set<std::string>* includes = (std::set<std::string>*)clientData;
+    CXString filename = clang_getFileName(includedFile);
+    if (clang_getCString(filename))
+        includes->insert(clang_getCString(filename));
+    clang_disposeString(filename);
+}
+
+CXTranslationUnit parseTranslationUnit(CXIndex cxindex,
+                                       const char* const* args, int nargs,
+                                       unsigned options)
+{
+    CXTranslationUnit tu = clang_parseTranslationUnit(
+        cxindex, 0,
+        args, nargs,
+        0, 0,
+        options);
+    if (!tu) {
+        fprintf(stderr, "ERROR: Could not parse `%s'.\n", args[nargs-1]);
+        return NULL;
+    }
+
+    // Print any errors or warnings
+    printDiagnostics(tu);
+    return tu;
+}
+
+bool reparseTranslationUnit(CXTranslationUnit tu) {
+    if (clang_reparseTranslationUnit(tu, 0, 0, clang_defaultReparseOptions(tu)) != 0)
+        return false;
+    printDiagnostics(tu);
+    return true;
+}
+
+void indexParsedTranslationUnit(CXIndex cxindex,
+                                CXTranslationUnit tu,
+                                const char* sourceFilename,
+                                ClicFlatIndex& index,
+                                const IndexerOptions& options,
+                                std::set<std::string>* includes)
+{
+    size_t cursors;
+    if (!options.useVisitor) {
+        CallbacksIndexer indexer(index, NULL, options);
+        indexer.indexTranslationUnit(cxindex, tu);
+        cursors = indexer.entitiesReported();
+    } else {
+        EverythingIndexer visitor(sourceFilename, index, options);
+        clang_visitChildren(
+                clang_getTranslationUnitCursor(tu),
+                &visitorFunction,
+                &visitor);
+        cursors = visitor.cursorsVisited;
+    }
+    if (options.stats)
+        options.stats->cursors += cursors;
+
+    if (includes)
+        clang_getInclusions(tu, &inclusionVisitor, includes);
+    index.finalize();
+}
+
+bool indexTranslationUnit(CXIndex cxindex,
+                          const char* const* args, int nargs,
+                          ClicFlatIndex& index,
+                          const IndexerOptions& options,
+                          std::set<std::string>* includes)
+{
+    if (!options.useVisitor) {
+        CallbacksIndexer indexer(index, includes, options);
+        bool ok;
+        {
+            ClicPhaseTimer timer(options.stats, &ClicStats::parse);
+            ok = indexer.indexSourceFile(cxindex, args, nargs);
+        }
+        if (options.stats)
+            options.stats->cursors += indexer.entitiesReported();
+        index.finalize();
+        return ok;
+    }
+
+    CXTranslationUnit tu;
+    {
+        ClicPhaseTimer timer(options.stats, &ClicStats::parse);
+        tu = parseTranslationUnit(cxindex, args, nargs, CXTranslationUnit_None);
+    }
+    if (!tu)
+        return false;
+
+    {
+        ClicPhaseTimer timer(options.stats, &ClicStats::visit);
+        indexParsedTranslationUnit(cxindex, tu, args[nargs-1], index, options, includes);
+    }
+    clang_disposeTranslationUnit(tu);
+    return true;
+}
+
+std::string cursorKindSpelling(uint32_t kind) {
+    CXString spelling = clang_getCursorKindSpelling(static_cast<CXCursorKind>(kind));
+    const char* str = clang_getCString(spelling);
+    std::string res = str ? str : "";
+    clang_disposeString(spelling);
+    return res;
+}
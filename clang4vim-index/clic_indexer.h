@@ -0,0 +1,157 @@
+#pragma once
+
+extern "C" {
+#include <clang-c/Index.h>
+}
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "clic_flat_index.h"
+
+class ClicStats;
+
+struct IndexerOptions {
+    // Walk the AST with clang_visitChildren instead of using the libclang
+    // indexing callbacks.
+    bool useVisitor = false;
+    // Let the files of a batch that are compiled with the same options
+    // share a precompiled header of the includes they start with, see
+    // ClicPrefixHeader.
+    bool sharePrefix = false;
+    // Where to account the time spent and the cursors seen, if anywhere
+    ClicStats* stats = nullptr;
+    // Do not record references located in system headers, which are the
+    // ones clang finds through -isystem and its default include paths.
+    bool skipSystemHeaders = false;
+    // If not empty, only record references located below one of these
+    // directories. Nothing below excludePaths is recorded either way.
+    // Both hold absolute paths without symbolic links.
+    std::vector<std::string> includePaths;
+    std::vector<std::string> excludePaths;
+};
+
+// Decides whether the references located in a file are recorded, by the
+// IndexerOptions above. The answer is worked out once per file.
+class ClicFileFilter {
+public:
+    explicit ClicFileFilter(const IndexerOptions& options);
+
+    // location is where a reference in file is
+    bool skip(CXFile file, CXSourceLocation location) {
+        if (!active)
+            return false;
+        auto cached = skipped.find(file);
+        if (cached != skipped.end())
+            return cached->second;
+        return skipped[file] = decide(file, location);
+    }
+
+private:
+    bool decide(CXFile file, CXSourceLocation location);
+
+    const IndexerOptions& options;
+    bool active;
+    std::unordered_map<CXFile, bool> skipped;
+};
+
+class IVisitor {
+public:
+    virtual enum CXChildVisitResult visit(CXCursor cursor, CXCursor parent) = 0;
+};
+
+class EverythingIndexer : public IVisitor {
+public:
+    EverythingIndexer(const char* translationUnitFilename, ClicFlatIndex& usrToReferences,
+                      const IndexerOptions& options)
+        : translationUnitFilename(translationUnitFilename),
+          usrToReferences(usrToReferences),
+          cursorsVisited(0),
+          filter(options) {}
+
+    // Filtered files are skipped with their whole subtree
+    virtual enum CXChildVisitResult visit(CXCursor cursor, CXCursor parent);
+
+    std::string translationUnitFilename;
+    ClicFlatIndex& usrToReferences;
+    size_t cursorsVisited;
+    ClicFileFilter filter;
+};
+
+enum CXChildVisitResult visitorFunction(
+        CXCursor cursor,
+        CXCursor parent,
+        CXClientData clientData);
+
+// Records the same references as EverythingIndexer from the declarations
+// and entity references reported by clang_indexSourceFile. File names are
+// looked up and interned once per CXFile, and USRs are read straight from
+// the callback data, so no CXString is created per reference.
+class CallbacksIndexer {
+public:
+    CallbacksIndexer(ClicFlatIndex& index, std::set<std::string>* includes,
+                     const IndexerOptions& options)
+        : index(index), includes(includes), printDiagnostics(false), entities(0),
+          filter(options) {}
+
+    bool indexSourceFile(CXIndex cxindex, const char* const* args, int nargs);
+    void indexTranslationUnit(CXIndex cxindex, CXTranslationUnit tu);
+    // Declarations and references reported so far
+    size_t entitiesReported() const { return entities; }
+
+private:
+    int run(CXIndex cxindex, const char* const* args, int nargs,
+            CXTranslationUnit tu);
+
+    static void diagnostic(CXClientData clientData, CXDiagnosticSet diagnostics, void* reserved);
+    static CXIdxClientFile enteredMainFile(CXClientData clientData, CXFile mainFile, void* reserved);
+    static CXIdxClientFile includedFile(CXClientData clientData, const CXIdxIncludedFileInfo* info);
+    static void declaration(CXClientData clientData, const CXIdxDeclInfo* info);
+    static void reference(CXClientData clientData, const CXIdxEntityRefInfo* info);
+
+    static const uint32_t noFile = ~0u;
+
+    uint32_t fileId(CXFile file);
+    void record(CXIdxLoc loc, CXCursorKind kind, const CXIdxEntityInfo* entity);
+
+    ClicFlatIndex& index;
+    std::set<std::string>* includes;
+    bool printDiagnostics;
+    size_t entities;
+    ClicFileFilter filter;
+
+    CXFile mainFile;
+    std::unordered_map<CXFile, uint32_t> fileIds;
+};
+
+// Parses a translation unit with the given compiler arguments, the last one
+// being the source file, and prints its diagnostics.
+CXTranslationUnit parseTranslationUnit(CXIndex cxindex,
+                                       const char* const* args, int nargs,
+                                       unsigned options);
+// Reparses with the same arguments, reusing the precompiled preamble if
+// the unit was parsed with one. On failure the unit must be disposed.
+bool reparseTranslationUnit(CXTranslationUnit tu);
+void indexParsedTranslationUnit(CXIndex cxindex,
+                                CXTranslationUnit tu,
+                                const char* sourceFilename,
+                                ClicFlatIndex& index,
+                                const IndexerOptions& options,
+                                std::set<std::string>* includes = nullptr);
+
+// Parses a translation unit with the given compiler arguments (the last one
+// being the source file) and adds its references to index, which is
+// finalized afterwards. If includes is
+// given, every file the translation unit includes, directly or
+// transitively, is added to it.
+// Returns false if clang could not produce a translation unit at all.
+bool indexTranslationUnit(CXIndex cxindex,
+                          const char* const* args, int nargs,
+                          ClicFlatIndex& index,
+                          const IndexerOptions& options,
+                          std::set<std::string>* includes = nullptr);
+
+// The libclang name of a cursor kind, e.g. "FunctionDecl"
+std::string cursorKindSpelling(uint32_t kind);
@@ -0,0 +1,99 @@
+#include <cstdio>
+
+#include "clic_location.h"
+
+std::string formatLocation(const std::string& path,
+                           uint32_t line, uint32_t column, uint32_t kind) {
+    std::string res;
+    appendLocation(res, path, line, column, kind);
+    return res;
+}
+
+void appendLocation(std::string& out, StringRef path,
+                    uint32_t line, uint32_t column, uint32_t kind) {
+    char buf[40];
+    int n = snprintf(buf, sizeof(buf), ":%u:%u:%u", line, column, kind);
+    out.append(path.data, path.size);
+    out.append(buf, n);
+}
+
+void appendVarint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool readVarint(const char*& p, const char* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; p != end && shift < 35; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+namespace {
+
+void appendOrdered(std::string& out, uint32_t value) {
+    int len = value > 0xffffff ? 4 : value > 0xffff ? 3 : value > 0xff ? 2 : value ? 1 : 0;
+    out += static_cast<char>(len);
+    for (int i = len - 1; i >= 0; --i)
+        out += static_cast<char>(value >> (8 * i));
+}
+
+bool readOrdered(const char*& p, const char* end, uint32_t& value) {
+    if (p == end)
+        return false;
+    int len = static_cast<uint8_t>(*p++);
+    if (len > 4 || end - p < len)
+        return false;
+    value = 0;
+    while (len--)
+        value = (value << 8) | static_cast<uint8_t>(*p++);
+    return true;
+}
+
+} // namespace
+
+void encodeLocationRecord(const ClicLocation& location, std::string& out) {
+    appendOrdered(out, location.file);
+    appendOrdered(out, location.line);
+    appendOrdered(out, location.column);
+    appendOrdered(out, location.kind);
+}
+
+bool decodeLocationRecord(const char* data, size_t size, ClicLocation& location) {
+    const char* p = data;
+    const char* end = data + size;
+    return readLocationRecord(p, end, location) && p == end;
+}
+
+bool readLocationRecord(const char*& p, const char* end, ClicLocation& location) {
+    return readOrdered(p, end, location.file) && readOrdered(p, end, location.line)
+        && readOrdered(p, end, location.column) && readOrdered(p, end, location.kind);
+}
+
+void encodeLocations(const std::vector<ClicLocation>& locations, std::string& out) {
+    ClicLocation prev = {0, 0, 0, 0};
+    for (const auto &loc : locations) {
+        appendVarint(out, loc.file - prev.file);
+        appendVarint(out, loc.file == prev.file ? loc.line - prev.line : loc.line);
+        appendVarint(out, loc.column);
+        appendVarint(out, loc.kind);
+        prev = loc;
+    }
+}
+
+bool readLocation(const char*& p, const char* end, ClicLocation& location) {
+    uint32_t fileDelta, line;
+    if (!readVarint(p, end, fileDelta) || !readVarint(p, end, line)
+            || !readVarint(p, end, location.column) || !readVarint(p, end, location.kind))
+        return false;
+    location.line = fileDelta == 0 ? location.line + line : line;
+    location.file += fileDelta;
+    return true;
+}
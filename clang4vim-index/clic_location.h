@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "types.h"
+
+// A reference as stored in the database: the path is replaced by the id
+// it was interned under.
+struct ClicLocation {
+    uint32_t file;
+    uint32_t line;
+    uint32_t column;
+    uint32_t kind;
+
+    bool operator<(const ClicLocation& rhs) const {
+        return std::tie(file, line, column, kind)
+            < std::tie(rhs.file, rhs.line, rhs.column, rhs.kind);
+    }
+    bool operator==(const ClicLocation& rhs) const {
+        return file == rhs.file && line == rhs.line
+            && column == rhs.column && kind == rhs.kind;
+    }
+};
+
+std::string formatLocation(const std::string& path,
+                           uint32_t line, uint32_t column, uint32_t kind);
+void appendLocation(std::string& out, StringRef path,
+                    uint32_t line, uint32_t column, uint32_t kind);
+
+void appendVarint(std::string& out, uint32_t value);
+bool readVarint(const char*& p, const char* end, uint32_t& value);
+
+// Encodes a single location so that memcmp order matches ClicLocation
+// order: every field is a length byte followed by its big endian bytes.
+void encodeLocationRecord(const ClicLocation& location, std::string& out);
+bool decodeLocationRecord(const char* data, size_t size, ClicLocation& location);
+// Reads one of several records stored back to back
+bool readLocationRecord(const char*& p, const char* end, ClicLocation& location);
+
+// Encodes sorted locations as varints. The file id is stored as a delta to
+// the previous location and so is the line while the file stays the same.
+void encodeLocations(const std::vector<ClicLocation>& locations, std::string& out);
+// Reads one location of such a block. location must hold the previous one,
+// or be zero for the first.
+bool readLocation(const char*& p, const char* end, ClicLocation& location);
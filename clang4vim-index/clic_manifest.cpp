@@ -0,0 +1,53 @@
+#include <fstream>
+
+#include "clic_manifest.h"
+
+// 64 bit FNV-1a
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i != size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool hashFile(const std::string& filename, uint64_t& hash) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good())
+        return false;
+
+    char buf[64 * 1024];
+    hash = hashBytes(NULL, 0);
+    while (in) {
+        in.read(buf, sizeof(buf));
+        hash = hashBytes(buf, in.gcount(), hash);
+    }
+    return in.eof();
+}
+
+uint64_t hashOptions(const std::vector<const char*>& options) {
+    uint64_t hash = hashBytes(NULL, 0);
+    for (const char* option : options) {
+        std::string str(option);
+        // Include the terminator so "-a -b" and "-a-b" differ
+        hash = hashBytes(str.c_str(), str.size() + 1, hash);
+    }
+    return hash;
+}
+
+void encodeManifestEntry(const ClicManifestEntry& entry, unsigned char (&buf)[16]) {
+    for (int i = 0; i != 8; ++i) {
+        buf[i] = entry.contentHash >> (56 - 8 * i);
+        buf[8 + i] = entry.flagsHash >> (56 - 8 * i);
+    }
+}
+
+ClicManifestEntry decodeManifestEntry(const void* data) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    ClicManifestEntry entry = {0, 0};
+    for (int i = 0; i != 8; ++i) {
+        entry.contentHash = (entry.contentHash << 8) | p[i];
+        entry.flagsHash = (entry.flagsHash << 8) | p[8 + i];
+    }
+    return entry;
+}
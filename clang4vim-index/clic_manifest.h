@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// What a file was last indexed from: a hash of its contents and a hash of
+// the compiler options it was parsed with.
+struct ClicManifestEntry {
+    uint64_t contentHash;
+    uint64_t flagsHash;
+
+    bool operator==(const ClicManifestEntry& rhs) const {
+        return contentHash == rhs.contentHash && flagsHash == rhs.flagsHash;
+    }
+    bool operator!=(const ClicManifestEntry& rhs) const {
+        return !(*this == rhs);
+    }
+};
+
+uint64_t hashBytes(const char* data, size_t size, uint64_t hash = 14695981039346656037ULL);
+bool hashFile(const std::string& filename, uint64_t& hash);
+uint64_t hashOptions(const std::vector<const char*>& options);
+
+void encodeManifestEntry(const ClicManifestEntry& entry, unsigned char (&buf)[16]);
+ClicManifestEntry decodeManifestEntry(const void* data);
@@ -0,0 +1,104 @@
+#include <fstream>
+#include <iostream>
+
+#include <unistd.h>
+
+#include "clic_pch.h"
+
+std::vector<std::string> leadingIncludes(const std::string& sourceFilename) {
+    std::vector<std::string> res;
+    std::ifstream in(sourceFilename.c_str());
+    std::string dir = sourceFilename.substr(0, sourceFilename.rfind('/') + 1);
+    bool inComment = false;
+
+    for (std::string line; std::getline(in, line); ) {
+        // Skip whitespace and block comments up to the first token
+        std::string::size_type i = 0;
+        for (;;) {
+            if (inComment) {
+                std::string::size_type close = line.find("*/", i);
+                if (close == std::string::npos) {
+                    i = line.size();
+                    break;
+                }
+                i = close + 2;
+                inComment = false;
+            }
+            i = line.find_first_not_of(" \t\r", i);
+            if (i == std::string::npos) {
+                i = line.size();
+                break;
+            }
+            if (line.compare(i, 2, "/*") != 0)
+                break;
+            inComment = true;
+            i += 2;
+        }
+        if (i == line.size() || line.compare(i, 2, "//") == 0)
+            continue;
+
+        if (line[i] != '#')
+            break;
+        i = line.find_first_not_of(" \t", i + 1);
+        if (i == std::string::npos || line.compare(i, 7, "include") != 0)
+            break;
+        // Also rejects #include_next and macro includes
+        i = line.find_first_not_of(" \t", i + 7);
+        if (i == std::string::npos || (line[i] != '<' && line[i] != '"'))
+            break;
+        std::string::size_type end = line.find(line[i] == '<' ? '>' : '"', i + 1);
+        if (end == std::string::npos)
+            break;
+
+        std::string header = line.substr(i + 1, end - i - 1);
+        if (line[i] == '"' && !header.empty() && header[0] != '/'
+                && access((dir + header).c_str(), F_OK) == 0)
+            res.push_back("#include \"" + dir + header + "\"");
+        else
+            res.push_back("#include " + line.substr(i, end - i + 1));
+    }
+    return res;
+}
+
+bool buildPrefixHeader(CXIndex cxindex,
+                       const std::vector<const char*>& clangOptions,
+                       const char* language,
+                       const std::vector<std::string>& includeLines,
+                       const std::string& headerFilename,
+                       const IndexerOptions& indexerOptions,
+                       ClicPrefixHeader& prefix) {
+    prefix.pchFilename.clear();
+    prefix.index.clear();
+    prefix.includes.clear();
+
+    std::ofstream out(headerFilename.c_str());
+    for (const auto &line : includeLines)
+        out << line << '\n';
+    out.close();
+    if (!out) {
+        std::cerr << "ERROR: Writing file `" << headerFilename << "'.\n";
+        return false;
+    }
+
+    std::vector<const char*> args(clangOptions);
+    args.push_back("-x");
+    args.push_back(language);
+    args.push_back(headerFilename.c_str());
+    CXTranslationUnit tu = parseTranslationUnit(
+            cxindex, args.data(), args.size(),
+            CXTranslationUnit_Incomplete | CXTranslationUnit_ForSerialization);
+    if (!tu)
+        return false;
+
+    // Headers with errors are not saved
+    std::string pchFilename = headerFilename + ".pch";
+    bool saved = clang_saveTranslationUnit(tu, pchFilename.c_str(),
+                                           clang_defaultSaveOptions(tu)) == CXSaveError_None;
+    if (saved) {
+        indexParsedTranslationUnit(cxindex, tu, headerFilename.c_str(),
+                                   prefix.index, indexerOptions, &prefix.includes);
+        prefix.pchFilename = pchFilename;
+    }
+    clang_disposeTranslationUnit(tu);
+    return saved;
+}
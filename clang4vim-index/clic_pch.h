@@ -0,0 +1,35 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "clic_flat_index.h"
+#include "clic_indexer.h"
+
+// The #include lines a source file starts with, up to the first line that
+// is neither blank, a comment nor an include. Quoted includes found next
+// to the file are made absolute, so equal lines name the same header
+// whichever file they come from.
+std::vector<std::string> leadingIncludes(const std::string& sourceFilename);
+
+// A precompiled header of the includes that several files compiled with
+// the same options start with, and what indexing it found. The files are
+// parsed with -include-pch and get these references added, so the shared
+// headers are parsed and indexed once instead of once per file.
+struct ClicPrefixHeader {
+    // Empty if no header was built
+    std::string pchFilename;
+    ClicFlatIndex index;
+    std::set<std::string> includes;
+};
+
+// Writes the include lines to headerFilename and saves them precompiled
+// for the given language ("c-header" or "c++-header") next to it.
+bool buildPrefixHeader(CXIndex cxindex,
+                       const std::vector<const char*>& clangOptions,
+                       const char* language,
+                       const std::vector<std::string>& includeLines,
+                       const std::string& headerFilename,
+                       const IndexerOptions& indexerOptions,
+                       ClicPrefixHeader& prefix);
@@ -1,23 +1,43 @@
+#include <algorithm>
+#include <iostream>
+
+#include <gzstream.h>
+
 #include "clic_printer.h"
 
-void printLocations(std::ostream& out, const std::set<std::string>& locations) {
-    bool first = true;
-    for(const auto &it : locations) {
-        if (!first)
+void printIndex(std::ostream& out, const ClicFlatIndex& index)
+{
+    const auto& refs = index.references();
+    for (size_t i = 0; i != refs.size(); ) {
+        uint32_t usr = refs[i].usr;
+        StringRef usrName = index.usr(usr);
+        if (usrName.empty()) {
+            for (; i != refs.size() && refs[i].usr == usr; ++i) {}
+            continue;
+        }
+
+        out.write(usrName.data, usrName.size);
+        for (; i != refs.size() && refs[i].usr == usr; ++i) {
+            StringRef file = index.file(refs[i].file);
             out << '\t';
-        out << it;
-        first = false;
+            out.write(file.data, file.size);
+            out << ':' << refs[i].line << ':' << refs[i].column << ':' << refs[i].kind;
+        }
+        out << '\n';
     }
 }
 
-void printIndex(std::ostream& out, const ClicIndex& index)
-{
-    for(const auto &it : index) {
-        if (!it.first.empty()) {
-            out << it.first << '\t';
-            printLocations(out, it.second);
-            out << std::endl;
-        }
-    }
+std::string indexFilenameFor(std::string sourceFilename) {
+    std::replace(sourceFilename.begin(), sourceFilename.end(), '/', '%');
+    return sourceFilename + ".i.gz";
 }
 
+bool writeIndexFile(const std::string& indexFilename, const ClicFlatIndex& index) {
+    ogzstream out(indexFilename.c_str());
+    if (!out.good()) {
+        std::cerr << "ERROR: Opening file `" << indexFilename << "'.\n";
+        return false;
+    }
+    printIndex(out, index);
+    return true;
+}
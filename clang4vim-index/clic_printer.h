@@ -1,8 +1,15 @@
 #pragma once
 
 #include <ostream>
+#include <string>
 
-#include "types.h"
+#include "clic_flat_index.h"
 
-void printLocations(std::ostream& out, const std::set<std::string>& locations);
-void printIndex(std::ostream& out, const ClicIndex& index);
+// One line per USR: the USR followed by its "path:line:column:kind"
+// locations, separated by tabs.
+void printIndex(std::ostream& out, const ClicFlatIndex& index);
+
+// Name of the side file holding the references contributed by a source file,
+// the same scheme clang4vim-index.sh uses.
+std::string indexFilenameFor(std::string sourceFilename);
+bool writeIndexFile(const std::string& indexFilename, const ClicFlatIndex& index);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// A FIFO between the threads of two pipeline stages. push blocks while
+// capacity items are waiting, so a slow stage holds back the ones before
+// it instead of letting their output pile up. Once the producers are done
+// and call close, pop drains what is left and then returns false.
+template<class T>
+class ClicQueue {
+public:
+    explicit ClicQueue(size_t capacity) : capacity(capacity ? capacity : 1), closed(false) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]() { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]() { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    ClicQueue(const ClicQueue&);
+    ClicQueue& operator=(const ClicQueue&);
+
+    const size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include "clic_location.h"
+#include "clic_run.h"
+
+namespace {
+
+class RunWriter {
+public:
+    explicit RunWriter(const std::string& runFilename)
+        : runFilename(runFilename), out(runFilename.c_str(), std::ios::binary) {}
+
+    void write(const std::string& record) {
+        appendVarint(buffer, record.size());
+        buffer += record;
+        if (buffer.size() >= 1 << 16)
+            flush();
+    }
+
+    bool close() {
+        flush();
+        out.close();
+        if (!out) {
+            std::cerr << "ERROR: Writing file `" << runFilename << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void flush() {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    std::string runFilename;
+    std::ofstream out;
+    std::string buffer;
+};
+
+} // namespace
+
+bool writeRun(const std::string& runFilename, std::vector<std::string>& records) {
+    std::sort(records.begin(), records.end());
+
+    RunWriter writer(runFilename);
+    for (const auto &record : records)
+        writer.write(record);
+    return writer.close();
+}
+
+bool reduceRuns(std::vector<std::string>& runFilenames, size_t maxRuns) {
+    while (runFilenames.size() > maxRuns) {
+        std::vector<std::string> group(runFilenames.begin(), runFilenames.begin() + maxRuns);
+        runFilenames.erase(runFilenames.begin(), runFilenames.begin() + maxRuns);
+
+        std::string merged = group.front() + ".merged";
+        ClicRunMerger merger(group);
+        RunWriter writer(merged);
+        std::string record;
+        for (uint32_t copies; merger.next(record, copies); )
+            while (copies--)
+                writer.write(record);
+        bool ok = writer.close() && merger.good();
+
+        for (const auto &runFilename : group)
+            remove(runFilename.c_str());
+        if (!ok) {
+            remove(merged.c_str());
+            return false;
+        }
+        runFilenames.push_back(merged);
+    }
+    return true;
+}
+
+// std::string compares its chars as unsigned, which is memcmp order
+bool ClicRunMerger::later(const Run* a, const Run* b) {
+    return a->record > b->record;
+}
+
+ClicRunMerger::ClicRunMerger(const std::vector<std::string>& runFilenames) : ok(true) {
+    for (const auto &runFilename : runFilenames) {
+        std::unique_ptr<Run> run(new Run);
+        run->in.open(runFilename.c_str(), std::ios::binary);
+        if (!run->in.good()) {
+            std::cerr << "ERROR: Opening file `" << runFilename << "'.\n";
+            ok = false;
+            continue;
+        }
+        if (read(*run))
+            heap.push_back(run.get());
+        runs.push_back(std::move(run));
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+}
+
+bool ClicRunMerger::read(Run& run) {
+    int c = run.in.get();
+    if (c == EOF)
+        return false;
+
+    uint32_t size = c & 0x7f;
+    for (int shift = 7; (c & 0x80) && shift < 35; shift += 7) {
+        if ((c = run.in.get()) == EOF)
+            break;
+        size |= static_cast<uint32_t>(c & 0x7f) << shift;
+    }
+    if (c != EOF && !(c & 0x80)) {
+        run.record.resize(size);
+        if (run.in.read(&run.record[0], size))
+            return true;
+    }
+
+    // A run must not end in the middle of a record
+    ok = false;
+    return false;
+}
+
+void ClicRunMerger::pop(std::string& record) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    Run* run = heap.back();
+    record.swap(run->record);
+    if (read(*run))
+        std::push_heap(heap.begin(), heap.end(), later);
+    else
+        heap.pop_back();
+}
+
+bool ClicRunMerger::next(std::string& record, uint32_t& copies) {
+    if (heap.empty())
+        return false;
+    pop(record);
+    for (copies = 1; !heap.empty() && heap.front()->record == record; ++copies)
+        pop(copy);
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Sorted runs for bulk loading. A run file holds byte strings in memcmp
+// order, each preceded by its length as a varint. The records are sorted
+// in place before they are written.
+bool writeRun(const std::string& runFilename, std::vector<std::string>& records);
+
+// Merges groups of runs into bigger ones until at most maxRuns are left,
+// so a final merge does not run out of file descriptors. The merged runs
+// are removed and the new ones are named after the first of their group.
+bool reduceRuns(std::vector<std::string>& runFilenames, size_t maxRuns);
+
+// Merges any number of runs into one sorted sequence, reading every run
+// front to back. A record found several times is returned once, with the
+// number of copies there were.
+class ClicRunMerger {
+public:
+    explicit ClicRunMerger(const std::vector<std::string>& runFilenames);
+
+    bool next(std::string& record, uint32_t& copies);
+    // False if a run could not be opened or ended in the middle of a record
+    bool good() const { return ok; }
+
+private:
+    struct Run {
+        std::ifstream in;
+        std::string record;
+    };
+
+    static bool later(const Run* a, const Run* b);
+    bool read(Run& run);
+    void pop(std::string& record);
+
+    std::vector<std::unique_ptr<Run>> runs;
+    // Min-heap of the runs that still have a current record
+    std::vector<Run*> heap;
+    // Receives the further copies of a record
+    std::string copy;
+    bool ok;
+};
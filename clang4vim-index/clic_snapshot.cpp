@@ -0,0 +1,128 @@
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "clic_snapshot.h"
+
+ClicSnapshot::ClicSnapshot() : base(NULL), size(0), header(NULL) {}
+
+ClicSnapshot::~ClicSnapshot() {
+    close();
+}
+
+void ClicSnapshot::close() {
+    if (base)
+        munmap(const_cast<char*>(base), size);
+    base = NULL;
+    size = 0;
+    header = NULL;
+}
+
+bool ClicSnapshot::open(const std::string& snapshotFilename) {
+    close();
+
+    int fd = ::open(snapshotFilename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "ERROR: Opening file `" << snapshotFilename << "'.\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ClicSnapshotHeader)) {
+        void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED) {
+            base = static_cast<const char*>(mapping);
+            size = st.st_size;
+        }
+    }
+    ::close(fd);
+
+    // Only the header is checked here; every access checks its offsets
+    // against the section it reads from.
+    const ClicSnapshotHeader* h = reinterpret_cast<const ClicSnapshotHeader*>(base);
+    auto fits = [&](uint64_t offset, uint64_t count) {
+        return offset % 8 == 0 && offset <= size && count <= (size - offset) / 8;
+    };
+    if (!base
+            || memcmp(h->magic, clicSnapshotMagic, sizeof(h->magic)) != 0
+            || h->byteOrder != clicSnapshotByteOrder
+            || h->version != clicSnapshotVersion
+            || h->size != size
+            || h->usrCount >= size || h->fileCount >= size
+            || !fits(h->usrOffsets, h->usrCount + 1)
+            || !fits(h->locationOffsets, h->usrCount + 1)
+            || !fits(h->fileOffsets, h->fileCount + 1)
+            || h->usrData > size || h->locationData > size || h->fileData > size) {
+        std::cerr << "ERROR: `" << snapshotFilename << "' is not a snapshot.\n";
+        close();
+        return false;
+    }
+    header = h;
+    return true;
+}
+
+StringRef ClicSnapshot::slice(const uint64_t* offsets, uint64_t count,
+                              uint64_t data, size_t i) const {
+    if (i >= count)
+        return StringRef();
+    uint64_t begin = offsets[i];
+    uint64_t end = offsets[i + 1];
+    if (begin > end || end > size - data)
+        return StringRef();
+    return StringRef(base + data + begin, end - begin);
+}
+
+StringRef ClicSnapshot::usr(size_t i) const {
+    if (!header)
+        return StringRef();
+    return slice(reinterpret_cast<const uint64_t*>(base + header->usrOffsets),
+                 header->usrCount, header->usrData, i);
+}
+
+StringRef ClicSnapshot::file(uint32_t id) const {
+    if (!header)
+        return StringRef();
+    return slice(reinterpret_cast<const uint64_t*>(base + header->fileOffsets),
+                 header->fileCount, header->fileData, id);
+}
+
+ClicSnapshot::LocationReader ClicSnapshot::locations(size_t i) const {
+    if (!header)
+        return LocationReader(NULL, NULL);
+    StringRef block = slice(reinterpret_cast<const uint64_t*>(base + header->locationOffsets),
+                            header->usrCount, header->locationData, i);
+    return LocationReader(block.data, block.data + block.size);
+}
+
+size_t ClicSnapshot::lowerBound(StringRef key) const {
+    size_t first = 0;
+    size_t count = usrCount();
+    while (count > 0) {
+        size_t half = count / 2;
+        if (usr(first + half) < key) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+size_t ClicSnapshot::find(StringRef key) const {
+    size_t i = lowerBound(key);
+    return i != usrCount() && usr(i) == key ? i : npos;
+}
+
+void ClicSnapshot::findPrefix(StringRef prefix, size_t& first, size_t& last) const {
+    first = lowerBound(prefix);
+    for (last = first; last != usrCount(); ++last) {
+        StringRef candidate = usr(last);
+        if (candidate.size < prefix.size
+                || memcmp(candidate.data, prefix.data, prefix.size) != 0)
+            break;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "types.h"
+#include "clic_location.h"
+
+// A read-only copy of the references for editors, see writeSnapshot. All
+// numbers are in host byte order and every section starts 8-byte aligned:
+//
+//   header
+//   usrOffsets       usrCount + 1 offsets into usrData, by sorted USR
+//   locationOffsets  usrCount + 1 offsets into locationData
+//   fileOffsets      fileCount + 1 offsets into fileData, by file id
+//   usrData, locationData, fileData
+//
+// The locations of a USR are one block as written by encodeLocations.
+struct ClicSnapshotHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint64_t usrCount;
+    uint64_t fileCount;
+    uint64_t usrOffsets;
+    uint64_t locationOffsets;
+    uint64_t fileOffsets;
+    uint64_t usrData;
+    uint64_t locationData;
+    uint64_t fileData;
+    uint64_t size;
+};
+
+static const char clicSnapshotMagic[8] = {'C', 'L', 'I', 'C', 'S', 'N', 'A', 'P'};
+static const uint32_t clicSnapshotByteOrder = 0x01020304;
+static const uint32_t clicSnapshotVersion = 1;
+
+// Maps a snapshot and answers lookups straight from the mapping, with a
+// binary search over the USR table and without allocating. Many processes
+// mapping the same snapshot share its pages.
+class ClicSnapshot {
+public:
+    static const size_t npos = size_t(-1);
+
+    class LocationReader {
+    public:
+        bool next(ClicLocation& location) {
+            if (p == end || !readLocation(p, end, prev))
+                return false;
+            location = prev;
+            return true;
+        }
+
+    private:
+        friend class ClicSnapshot;
+        LocationReader(const char* p, const char* end) : p(p), end(end), prev() {}
+
+        const char* p;
+        const char* end;
+        ClicLocation prev;
+    };
+
+    ClicSnapshot();
+    ~ClicSnapshot();
+
+    bool open(const std::string& snapshotFilename);
+
+    size_t usrCount() const { return header ? header->usrCount : 0; }
+    StringRef usr(size_t i) const;
+    StringRef file(uint32_t id) const;
+    LocationReader locations(size_t i) const;
+
+    // The index of usr, or npos
+    size_t find(StringRef usr) const;
+    // The indices [first, last) of the USRs starting with prefix
+    void findPrefix(StringRef prefix, size_t& first, size_t& last) const;
+
+private:
+    ClicSnapshot(const ClicSnapshot&);
+    ClicSnapshot& operator=(const ClicSnapshot&);
+
+    void close();
+    StringRef slice(const uint64_t* offsets, uint64_t count, uint64_t data, size_t i) const;
+    size_t lowerBound(StringRef usr) const;
+
+    const char* base;
+    size_t size;
+    const ClicSnapshotHeader* header;
+};
@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "clic_snapshot.h"
+#include "clic_snapshot_writer.h"
+
+namespace {
+
+// Appends a section at the next 8-byte boundary and returns its offset
+uint64_t writeSection(std::ofstream& out, const void* data, size_t size) {
+    static const char padding[8] = {0};
+    uint64_t offset = out.tellp();
+    if (offset % 8) {
+        out.write(padding, 8 - offset % 8);
+        offset += 8 - offset % 8;
+    }
+    out.write(static_cast<const char*>(data), size);
+    return offset;
+}
+
+} // namespace
+
+bool writeSnapshot(const std::string& snapshotFilename, ClicDb& db) {
+    std::string tmpFilename = snapshotFilename + ".tmp";
+    std::ofstream out(tmpFilename.c_str(), std::ios::binary);
+
+    ClicSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // The location blocks go straight to the file; the USR table is kept
+    // until the end.
+    header.locationData = out.tellp();
+    std::vector<uint64_t> usrOffsets(1, 0);
+    std::vector<uint64_t> locationOffsets(1, 0);
+    std::vector<bool> usedFiles;
+    std::string usrData;
+    std::string current;
+    std::vector<ClicLocation> locations;
+    std::string block;
+
+    auto flush = [&]() {
+        if (locations.empty())
+            return;
+        block.clear();
+        encodeLocations(locations, block);
+        out.write(block.data(), block.size());
+        locationOffsets.push_back(locationOffsets.back() + block.size());
+        usrData += current;
+        usrOffsets.push_back(usrData.size());
+        locations.clear();
+    };
+
+    db.forEachRecordWithPrefix("", [&](StringRef usr, const ClicLocation& location) {
+        if (usr != StringRef(current)) {
+            flush();
+            current.assign(usr.data, usr.size);
+        }
+        locations.push_back(location);
+        if (location.file >= usedFiles.size())
+            usedFiles.resize(location.file + 1);
+        usedFiles[location.file] = true;
+    });
+    flush();
+
+    // Files are looked up by id, ids nothing refers to stay empty
+    std::vector<uint64_t> fileOffsets(1, 0);
+    std::string fileData;
+    for (uint32_t id = 0; id != usedFiles.size(); ++id) {
+        if (usedFiles[id])
+            fileData += db.fileName(id);
+        fileOffsets.push_back(fileData.size());
+    }
+
+    memcpy(header.magic, clicSnapshotMagic, sizeof(header.magic));
+    header.byteOrder = clicSnapshotByteOrder;
+    header.version = clicSnapshotVersion;
+    header.usrCount = usrOffsets.size() - 1;
+    header.fileCount = fileOffsets.size() - 1;
+    header.usrOffsets = writeSection(out, usrOffsets.data(), usrOffsets.size() * 8);
+    header.locationOffsets = writeSection(out, locationOffsets.data(), locationOffsets.size() * 8);
+    header.fileOffsets = writeSection(out, fileOffsets.data(), fileOffsets.size() * 8);
+    header.usrData = writeSection(out, usrData.data(), usrData.size());
+    header.fileData = writeSection(out, fileData.data(), fileData.size());
+    header.size = out.tellp();
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+
+    if (!out || rename(tmpFilename.c_str(), snapshotFilename.c_str()) != 0) {
+        std::cerr << "ERROR: Writing file `" << snapshotFilename << "'.\n";
+        remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+#include "ClicDb.h"
+
+// Writes every reference of the database to a snapshot that ClicSnapshot
+// can map. The snapshot is written next to its final name and renamed
+// over it, so readers mapping the old one are not disturbed.
+bool writeSnapshot(const std::string& snapshotFilename, ClicDb& db);
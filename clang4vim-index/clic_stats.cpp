@@ -0,0 +1,77 @@
+#include <cstdio>
+
+#include <time.h>
+
+#include "ClicDb.h"
+#include "clic_stats.h"
+
+namespace {
+
+uint64_t now(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+std::string seconds(uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.6f", ns / 1e9);
+    return buf;
+}
+
+void printPhase(std::ostream& out, const char* name, const ClicPhaseTime& phase) {
+    out << '"' << name << "\":{\"wall\":" << seconds(phase.wallNs)
+        << ",\"cpu\":" << seconds(phase.cpuNs) << '}';
+}
+
+} // namespace
+
+ClicStats::ClicStats()
+    : files(0), failedFiles(0), cursors(0), references(0), usrs(0), indexBytes(0),
+      startWallNs(now(CLOCK_MONOTONIC)), startCpuNs(now(CLOCK_PROCESS_CPUTIME_ID)) {}
+
+void ClicStats::print(std::ostream& out, const std::string& command, const ClicDbStats& db) const {
+    // The command is one of ours, so it needs no escaping
+    out << "{\"command\":\"" << command << '"'
+        << ",\"wall\":" << seconds(now(CLOCK_MONOTONIC) - startWallNs)
+        << ",\"cpu\":" << seconds(now(CLOCK_PROCESS_CPUTIME_ID) - startCpuNs)
+        << ",\"phases\":{";
+    printPhase(out, "prefix", prefix);
+    out << ',';
+    printPhase(out, "parse", parse);
+    out << ',';
+    printPhase(out, "visit", visit);
+    out << ',';
+    printPhase(out, "write", write);
+    out << ',';
+    printPhase(out, "commit", commit);
+    out << ',';
+    printPhase(out, "load", load);
+    out << "},\"files\":" << files
+        << ",\"failedFiles\":" << failedFiles
+        << ",\"cursors\":" << cursors
+        << ",\"references\":" << references
+        << ",\"usrs\":" << usrs
+        << ",\"indexBytes\":" << indexBytes
+        << ",\"db\":{\"gets\":" << db.gets
+        << ",\"getBytes\":" << db.getBytes
+        << ",\"puts\":" << db.puts
+        << ",\"putBytes\":" << db.putBytes
+        << ",\"dels\":" << db.dels
+        << "}}\n";
+}
+
+ClicPhaseTimer::ClicPhaseTimer(ClicStats* stats, ClicPhaseTime ClicStats::* phase)
+    : phase(stats ? &(stats->*phase) : nullptr), startWallNs(0), startCpuNs(0) {
+    if (!this->phase)
+        return;
+    startWallNs = now(CLOCK_MONOTONIC);
+    startCpuNs = now(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+ClicPhaseTimer::~ClicPhaseTimer() {
+    if (!phase)
+        return;
+    phase->wallNs += now(CLOCK_MONOTONIC) - startWallNs;
+    phase->cpuNs += now(CLOCK_PROCESS_CPUTIME_ID) - startCpuNs;
+}
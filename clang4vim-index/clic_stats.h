@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <string>
+
+#include <stdint.h>
+
+struct ClicDbStats;
+
+// Wall and CPU time spent in a phase, summed over the threads running it.
+// The CPU time is that of the whole process while the phase ran: libclang
+// parses on threads of its own, which the clock of the calling thread
+// would miss. With several jobs the phases overlap, so their CPU times
+// add up to more than the process used; use --jobs=1 to compare them.
+struct ClicPhaseTime {
+    std::atomic<uint64_t> wallNs;
+    std::atomic<uint64_t> cpuNs;
+
+    ClicPhaseTime() : wallNs(0), cpuNs(0) {}
+};
+
+// What --stats reports about a run. Phases and counters are updated by
+// the indexing threads as they go; with several jobs the phase times add
+// up to more than the wall time of the run.
+class ClicStats {
+public:
+    ClicStats();
+
+    // Building the shared precompiled headers
+    ClicPhaseTime prefix;
+    // clang parsing the files. The indexing callbacks run while clang
+    // parses, so without --visitor this includes recording references.
+    ClicPhaseTime parse;
+    // Walking the AST of a parsed unit with --visitor
+    ClicPhaseTime visit;
+    // Printing and compressing the index files
+    ClicPhaseTime write;
+    // Adding the references of each file to the database or staging them
+    // in a sorted run
+    ClicPhaseTime commit;
+    // Merging the sorted runs into the database after build
+    ClicPhaseTime load;
+
+    std::atomic<uint64_t> files;
+    std::atomic<uint64_t> failedFiles;
+    // AST cursors visited, or entities reported by the indexing callbacks
+    std::atomic<uint64_t> cursors;
+    // Distinct references and USRs in the index of each file, summed
+    std::atomic<uint64_t> references;
+    std::atomic<uint64_t> usrs;
+    // Size of the compressed index files written
+    std::atomic<uint64_t> indexBytes;
+
+    // Writes everything as one line of JSON
+    void print(std::ostream& out, const std::string& command, const ClicDbStats& db) const;
+
+private:
+    ClicStats(const ClicStats&);
+    ClicStats& operator=(const ClicStats&);
+
+    uint64_t startWallNs;
+    uint64_t startCpuNs;
+};
+
+// Adds the time from construction to destruction to a phase of stats.
+// Does nothing if stats is null.
+class ClicPhaseTimer {
+public:
+    ClicPhaseTimer(ClicStats* stats, ClicPhaseTime ClicStats::* phase);
+    ~ClicPhaseTimer();
+
+private:
+    ClicPhaseTimer(const ClicPhaseTimer&);
+    ClicPhaseTimer& operator=(const ClicPhaseTimer&);
+
+    ClicPhaseTime* phase;
+    uint64_t startWallNs;
+    uint64_t startCpuNs;
+};
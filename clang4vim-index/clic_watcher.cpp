@@ -0,0 +1,170 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "clic_watcher.h"
+
+static const uint32_t watchMask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE
+                                | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+ClicWatcher::ClicWatcher() : fd(inotify_init1(IN_CLOEXEC)), signalFd(-1), stopping(false) {
+    // Threads inherit the blocked signals, so only signalFd receives them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+}
+
+ClicWatcher::~ClicWatcher() {
+    if (signalFd >= 0)
+        close(signalFd);
+    if (fd >= 0)
+        close(fd);
+}
+
+bool ClicWatcher::watch(const std::string& directory) {
+    char path[PATH_MAX];
+    if (fd < 0 || signalFd < 0 || !realpath(directory.c_str(), path)) {
+        std::cerr << "ERROR: Watching `" << directory << "': " << strerror(errno) << "\n";
+        return false;
+    }
+    root = path;
+    return addTree(root, nullptr);
+}
+
+bool ClicWatcher::addTree(const std::string& directory, std::set<std::string>* filenames) {
+    // The watch comes first, so nothing created meanwhile is missed
+    int wd = inotify_add_watch(fd, directory.c_str(), watchMask);
+    if (wd < 0) {
+        // The directory may already be gone again
+        if (errno == ENOENT || errno == ENOTDIR)
+            return true;
+        std::cerr << "ERROR: Watching `" << directory << "': " << strerror(errno) << "\n";
+        return false;
+    }
+    directories[wd] = directory;
+
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+        return true;
+    bool ok = true;
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.')
+            continue;
+        std::string path = directory + "/" + entry->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            ok &= addTree(path, filenames);
+        else if (filenames)
+            filenames->insert(path);
+    }
+    closedir(dir);
+    return ok;
+}
+
+void ClicWatcher::forgetTree(const std::string& directory) {
+    std::string prefix = directory + "/";
+    for (auto it = directories.begin(); it != directories.end(); ) {
+        if (it->second == directory || it->second.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(fd, it->first);
+            it = directories.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ClicWatcher::listFiles(std::set<std::string>& filenames) {
+    addTree(root, &filenames);
+}
+
+ClicWatcher::Result ClicWatcher::wait(unsigned debounceMs, std::set<std::string>& modified,
+                                      std::set<std::string>& removed, bool& overflowed) {
+    modified.clear();
+    removed.clear();
+    overflowed = false;
+
+    alignas(struct inotify_event) char buf[64 * 1024];
+    int timeout = -1;
+    while (!stopping) {
+        struct pollfd pfds[] = {{fd, POLLIN, 0}, {signalFd, POLLIN, 0}};
+        int ready = poll(pfds, 2, timeout);
+        if (ready == 0)
+            return Changed;
+        if (ready > 0 && pfds[1].revents) {
+            struct signalfd_siginfo info;
+            if (read(signalFd, &info, sizeof(info)) == sizeof(info))
+                stopping = true;
+            continue;
+        }
+        ssize_t size = ready < 0 ? -1 : read(fd, buf, sizeof(buf));
+        if (size < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "ERROR: Reading file change events: " << strerror(errno) << "\n";
+            return Failed;
+        }
+
+        for (char* p = buf; p < buf + size; ) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+            auto dir = directories.find(event->wd);
+            if (dir == directories.end())
+                continue;
+            if (event->mask & IN_IGNORED) {
+                directories.erase(dir);
+                if (directories.empty())
+                    stopping = true;
+                continue;
+            }
+            if (!event->len || event->name[0] == '.')
+                continue;
+
+            std::string path = dir->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    // Files may have been created before the watch was
+                    std::set<std::string> filenames;
+                    addTree(path, &filenames);
+                    for (const auto &filename : filenames) {
+                        modified.insert(filename);
+                        removed.erase(filename);
+                    }
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    forgetTree(path);
+                    removed.insert(path + "/");
+                }
+            } else if (event->mask & (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                modified.insert(path);
+                removed.erase(path);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                removed.insert(path);
+                modified.erase(path);
+            }
+        }
+
+        if (!modified.empty() || !removed.empty() || overflowed)
+            timeout = debounceMs;
+    }
+    return !modified.empty() || !removed.empty() || overflowed ? Changed : Stopped;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Watches a directory tree with inotify, one watch per directory. Hidden
+// directories such as .git are left out. SIGINT and SIGTERM stop the
+// watcher rather than the process; create it before starting any thread
+// so they reach it.
+class ClicWatcher {
+public:
+    enum Result { Changed, Stopped, Failed };
+
+    ClicWatcher();
+    ~ClicWatcher();
+
+    bool watch(const std::string& directory);
+
+    // Blocks until something changed and then nothing more for debounceMs,
+    // so a burst like a branch checkout comes as one batch. Files that were
+    // written, created or moved in are put in modified, deleted or moved
+    // out ones in removed, a removed directory with a trailing '/'. If the
+    // kernel dropped events, overflowed is set and the caller has to
+    // compare everything itself. Returns Stopped after a signal or once
+    // the watched directory is gone, but changes seen before come first.
+    Result wait(unsigned debounceMs, std::set<std::string>& modified,
+                std::set<std::string>& removed, bool& overflowed);
+
+    // Every file in the watched tree
+    void listFiles(std::set<std::string>& filenames);
+
+private:
+    ClicWatcher(const ClicWatcher&);
+    ClicWatcher& operator=(const ClicWatcher&);
+
+    bool addTree(const std::string& directory, std::set<std::string>* filenames);
+    void forgetTree(const std::string& directory);
+
+    int fd;
+    int signalFd;
+    bool stopping;
+    std::string root;
+    std::unordered_map<int, std::string> directories;
+};
@@ -1,177 +1,1113 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
-#include <sstream>
+#include <thread>
+#include <vector>
 
-extern "C" {
-#include <clang-c/Index.h>
-}
-
-#include <gzstream.h>
+#include <sys/stat.h>
 
 #include "ClicDb.h"
 #include "types.h"
+#include "clic_compdb.h"
+#include "clic_daemon.h"
+#include "clic_indexer.h"
+#include "clic_pch.h"
 #include "clic_printer.h"
-#include "clic_parser.h"
+#include "clic_queue.h"
+#include "clic_run.h"
+#include "clic_snapshot.h"
+#include "clic_snapshot_writer.h"
+#include "clic_stats.h"
+#include "clic_watcher.h"
+
+const char *prg = "";
+
+void usage() {
+    std::cerr << "Usage:\n"
+        << "\t" << prg << " add    [--stats[=<file>]] [<dbOptions>] [<indexerOptions>] <dbFilename> <indexFilename> [<options>] <sourceFilename>\n"
+        << "\t" << prg << " batch  [--jobs=<n>] [--compdb] [--stats[=<file>]] [<dbOptions>] [<indexerOptions>] <dbFilename> <fileListFilename> [<options>]\n"
+        << "\t" << prg << " build  [--jobs=<n>] [--compdb] [--stats[=<file>]] [<dbOptions>] [<indexerOptions>] <dbFilename> <fileListFilename> [<options>]\n"
+        << "\t" << prg << " update [--jobs=<n>] [--compdb] [--stats[=<file>]] [<dbOptions>] [<indexerOptions>] <dbFilename> <fileListFilename> [<options>]\n"
+        << "\t" << prg << " watch  --txn [--jobs=<n>] [--debounce=<ms>] [--compdb=<compileCommandsFilename>] [<dbOptions>] [<indexerOptions>] <dbFilename> <directory> [<options>]\n"
+        << "\t" << prg << " rm     [<dbOptions>] <dbFilename> <sourceFilename>\n"
+        << "\t" << prg << " query  [--prefix] [<dbOptions>] <dbFilename> <usr>...\n"
+        << "\t" << prg << " query  --snapshot [--prefix] <snapshotFilename> <usr>...\n"
+        << "\t" << prg << " names  [--substring] [<dbOptions>] <dbFilename> <name>...\n"
+        << "\t" << prg << " daemon --txn [<dbOptions>] [<indexerOptions>] <dbFilename> <socketFilename>\n"
+        << "\t" << prg << " compact [--fill=<percent>] [<dbOptions>] <dbFilename>\n"
+        << "\t" << prg << " export-snapshot [<dbOptions>] <dbFilename> <snapshotFilename>\n"
+        << "\t" << prg << " clear  [<dbOptions>] <dbFilename>\n"
+        << "Database options:\n"
+        << "\t--txn          use a transactional environment next to the database, so\n"
+        << "\t               several processes can update it at the same time.\n"
+        << "\t               Fixed when the database is created, watch and daemon\n"
+        << "\t               need it\n"
+        << "\t--cache=<MiB>  size of the database page cache\n"
+        << "\t--shards=<n>   split the references over n files by USR when\n"
+        << "\t               creating the database\n"
+        << "Statistics:\n"
+        << "\t--stats[=<file>]  print the time spent in each phase, the work done and\n"
+        << "\t                  the database accesses as a line of JSON, or append it\n"
+        << "\t                  to file. Phase CPU times are those of the whole\n"
+        << "\t                  process, so they only add up with --jobs=1\n"
+        << "Name options:\n"
+        << "\t--substring  find the names containing <name> rather than starting\n"
+        << "\t             with it. A <name> shorter than three bytes reads all names\n"
+        << "File list options:\n"
+        << "\t--compdb  the file list is a compile_commands.json giving the options\n"
+        << "\t          of every file, <options> are appended to them. watch takes\n"
+        << "\t          the compile_commands.json as the value and only indexes the\n"
+        << "\t          files it lists\n"
+        << "Indexer options:\n"
+        << "\t--visitor  walk the AST instead of using the libclang indexing callbacks\n"
+        << "\t--pch      let files compiled with the same options share a precompiled\n"
+        << "\t           header of the includes they start with\n"
+        << "\t--skip-system-headers       do not record references located in\n"
+        << "\t                            system headers\n"
+        << "\t--include-paths=<dir>[:...] only record references located below\n"
+        << "\t                            these directories\n"
+        << "\t--exclude-paths=<dir>[:...] do not record references located below\n"
+        << "\t                            these directories\n";
+}
+
+// Consumes the "--name[=value]" options following the command name and
+// leaves pos at the first positional argument.
+std::map<std::string, std::string> parseOptions(int argc, const char* argv[], int& pos) {
+    std::map<std::string, std::string> options;
+    for (; pos < argc && std::string(argv[pos]).compare(0, 2, "--") == 0; ++pos) {
+        std::string arg(argv[pos] + 2);
+        std::string::size_type eq = arg.find('=');
+        if (eq == std::string::npos)
+            options[arg] = "";
+        else
+            options[arg.substr(0, eq)] = arg.substr(eq + 1);
+    }
+    return options;
+}
+
+// The value of a numeric option, or fallback if it is not given. Anything
+// but a decimal number that fits prints the usage and exits.
+unsigned numberOption(std::map<std::string, std::string>& options, const char* name,
+                      unsigned fallback) {
+    if (!options.count(name))
+        return fallback;
+    const std::string& value = options[name];
+    char* end = NULL;
+    errno = 0;
+    unsigned long n = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || !isdigit(static_cast<unsigned char>(value[0])) || *end
+            || errno == ERANGE || n > UINT_MAX) {
+        usage();
+        exit(1);
+    }
+    return n;
+}
 
-// This code intentionally leaks memory like a sieve because the program is shortlived.
+ClicDbOptions dbOptions(std::map<std::string, std::string>& options) {
+    ClicDbOptions res;
+    res.transactional = options.count("txn") != 0;
+    res.cacheSizeMb = numberOption(options, "cache", 0);
+    res.shards = numberOption(options, "shards", 0);
+    return res;
+}
+
+// The directories of a colon separated list, resolved like the file names
+// they are compared with
+std::vector<std::string> directoryList(const std::string& list) {
+    std::vector<std::string> res;
+    for (const auto &directory : split(list, ':')) {
+        if (directory.empty())
+            continue;
+        char resolved[PATH_MAX];
+        res.push_back(realpath(directory.c_str(), resolved) ? resolved : directory);
+    }
+    return res;
+}
 
-class IVisitor {
-public:
-    virtual enum CXChildVisitResult visit(CXCursor cursor, CXCursor parent) = 0;
+// stats is only used with --stats
+IndexerOptions indexerOptions(std::map<std::string, std::string>& options,
+                              ClicStats* stats = nullptr) {
+    IndexerOptions res;
+    res.useVisitor = options.count("visitor") != 0;
+    res.sharePrefix = options.count("pch") != 0;
+    if (options.count("stats"))
+        res.stats = stats;
+    res.skipSystemHeaders = options.count("skip-system-headers") != 0;
+    if (options.count("include-paths"))
+        res.includePaths = directoryList(options["include-paths"]);
+    if (options.count("exclude-paths"))
+        res.excludePaths = directoryList(options["exclude-paths"]);
+    return res;
+}
+
+// Prints the statistics of a run with --stats, or appends them to the
+// file given as its value
+bool reportStats(std::map<std::string, std::string>& options, const char* command,
+                 const ClicStats& stats, const ClicDb& db) {
+    if (!options.count("stats"))
+        return true;
+    const std::string& statsFilename = options["stats"];
+    if (statsFilename.empty()) {
+        stats.print(std::cout, command, db.stats());
+        return true;
+    }
+    std::ofstream out(statsFilename.c_str(), std::ios::app);
+    if (!out.good()) {
+        std::cerr << "ERROR: Opening file `" << statsFilename << "'.\n";
+        return false;
+    }
+    stats.print(out, command, db.stats());
+    return true;
+}
+
+unsigned jobsOption(std::map<std::string, std::string>& options) {
+    unsigned jobs = numberOption(options, "jobs", std::thread::hardware_concurrency());
+    return jobs ? jobs : 1;
+}
+
+bool readFileList(const char* fileListFilename, std::vector<std::string>& sourceFilenames) {
+    std::ifstream fileList(fileListFilename);
+    if (!fileList.good()) {
+        std::cerr << "ERROR: Opening file `" << fileListFilename << "'.\n";
+        return false;
+    }
+    for (std::string line; std::getline(fileList, line); )
+        if (!line.empty())
+            sourceFilenames.push_back(line);
+    return true;
+}
+
+// The files to index and the compiler options of each. Files compiled with
+// the same options form a group. A file is only added once.
+struct SourceFiles {
+    std::vector<std::string> filenames;
+    std::vector<size_t> groups;
+    std::vector<std::vector<std::string>> groupOptions;
+
+    void add(const std::string& filename, const std::vector<std::string>& options) {
+        if (!known.insert(filename).second)
+            return;
+        auto group = groupIds.insert(std::make_pair(options, groupOptions.size())).first;
+        if (group->second == groupOptions.size())
+            groupOptions.push_back(options);
+        filenames.push_back(filename);
+        groups.push_back(group->second);
+    }
+
+    size_t size() const { return filenames.size(); }
+    const std::vector<std::string>& options(size_t i) const { return groupOptions[groups[i]]; }
+    uint64_t flagsHash(size_t i) const { return hashOptions(args(groups[i])); }
+
+    std::vector<const char*> args(size_t group) const {
+        std::vector<const char*> res;
+        for (const auto &option : groupOptions[group])
+            res.push_back(option.c_str());
+        return res;
+    }
+
+private:
+    std::set<std::string> known;
+    std::map<std::vector<std::string>, size_t> groupIds;
 };
 
-class EverythingIndexer : public IVisitor {
-public:
-    EverythingIndexer(const char* translationUnitFilename)
-        : translationUnitFilename(translationUnitFilename) {}
-
-    virtual enum CXChildVisitResult visit(CXCursor cursor, CXCursor parent) {
-        CXFile file;
-        unsigned int line, column, offset;
-        clang_getInstantiationLocation(
-                clang_getCursorLocation(cursor),
-                &file, &line, &column, &offset);
-        CXCursorKind kind = clang_getCursorKind(cursor);
-        const char* cursorFilename = clang_getCString(clang_getFileName(file));
-
-        if (!clang_getFileName(file).data || translationUnitFilename == cursorFilename) {
-            return CXChildVisit_Continue;
-        }
-
-        CXCursor refCursor = clang_getCursorReferenced(cursor);
-        if (!clang_equalCursors(refCursor, clang_getNullCursor())) {
-            CXFile refFile;
-            unsigned int refLine, refColumn, refOffset;
-            clang_getInstantiationLocation(
-                    clang_getCursorLocation(refCursor),
-                    &refFile, &refLine, &refColumn, &refOffset);
-
-            if (clang_getFileName(refFile).data) {
-                std::string referencedUsr(clang_getCString(clang_getCursorUSR(refCursor)));
-                if (!referencedUsr.empty()) {
-                    std::stringstream ss;
-                    ss << cursorFilename
-                       << ":" << line << ":" << column << ":" << kind;
-                    std::string location(ss.str());
-                    usrToReferences[referencedUsr].insert(location);
-                }
-            }
+// Reads the files to index from a file list, all compiled with
+// clangOptions, or with --compdb from a compile_commands.json whose
+// options get clangOptions appended.
+bool readSourceFiles(std::map<std::string, std::string>& options,
+                     const char* filename,
+                     const std::vector<std::string>& clangOptions,
+                     SourceFiles& files) {
+    if (!options.count("compdb")) {
+        std::vector<std::string> sourceFilenames;
+        if (!readFileList(filename, sourceFilenames))
+            return false;
+        for (const auto &sourceFilename : sourceFilenames)
+            files.add(sourceFilename, clangOptions);
+        return true;
+    }
+
+    std::vector<ClicCompileCommand> commands;
+    if (!readCompileCommands(filename, commands))
+        return false;
+    for (auto &command : commands) {
+        command.options.insert(command.options.end(), clangOptions.begin(), clangOptions.end());
+        files.add(command.filename, command.options);
+    }
+    return true;
+}
+
+// Builds the prefix header of a group if at least two of its files, all
+// in the same language, start with the same includes.
+void buildGroupPrefix(CXIndex cxindex, const SourceFiles& files, size_t group,
+                      const IndexerOptions& indexerOptions,
+                      const std::string& headerFilename,
+                      ClicPrefixHeader& prefix) {
+    std::vector<std::string> common;
+    size_t members = 0;
+    bool c = false, cplusplus = false;
+    for (size_t i = 0; i != files.size(); ++i) {
+        if (files.groups[i] != group)
+            continue;
+        const std::string& filename = files.filenames[i];
+        if (filename.size() > 2 && filename.compare(filename.size() - 2, 2, ".c") == 0)
+            c = true;
+        else
+            cplusplus = true;
+
+        std::vector<std::string> lines = leadingIncludes(filename);
+        if (members++ == 0) {
+            common = lines;
+        } else {
+            size_t n = 0;
+            while (n != common.size() && n != lines.size() && common[n] == lines[n])
+                ++n;
+            common.resize(n);
         }
-        return CXChildVisit_Recurse;
+        if (common.empty() || (c && cplusplus))
+            return;
     }
+    if (members < 2)
+        return;
 
-    std::string translationUnitFilename;
-    ClicIndex usrToReferences;
+    buildPrefixHeader(cxindex, files.args(group), c ? "c-header" : "c++-header",
+                      common, headerFilename, indexerOptions, prefix);
+}
+
+typedef std::function<void(size_t file,
+                           const std::set<std::string>& includes)> IndexedCallback;
+
+// A file on its way through the stages of indexFiles
+struct IndexedFile {
+    size_t file;
+    std::unique_ptr<ClicFlatIndex> index;
+    std::set<std::string> includes;
 };
 
-enum CXChildVisitResult visitorFunction(
-        CXCursor cursor,
-        CXCursor parent,
-        CXClientData clientData)
-{
-    IVisitor* visitor = (IVisitor*)clientData;
-    return visitor->visit(cursor, parent);
+// The references of a file the committer staged for its run
+struct StagedFile {
+    size_t file;
+    size_t references;
+    size_t usrs;
+    std::vector<std::string> records;
+};
+
+// Indexes the files in a pipeline of three stages:
+//   - a pool of parsing workers, each with its own CXIndex,
+//   - writers that compress the index files,
+//   - a single committer, the calling thread, that owns the database.
+// Bounded queues between the stages let parsing go on while the database
+// is busy and the other way round; at most jobs parsed files wait in each.
+// The committer replaces what a file contributed before and calls
+// onIndexed in one transaction, so a file that fails keeps its old
+// references.
+//
+// With runFilenames, which names a run for every file, the references are
+// staged instead of added to refs, and a fourth stage of run writers sorts
+// and writes them to the runs. The names of files that failed are cleared.
+bool indexFiles(ClicDb& db,
+                const SourceFiles& files,
+                const IndexerOptions& indexerOptions,
+                unsigned jobs,
+                IndexedCallback onIndexed = nullptr,
+                std::vector<std::string>* runFilenames = nullptr) {
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    ClicQueue<IndexedFile> parsed(jobs);
+    ClicQueue<IndexedFile> written(jobs);
+    ClicQueue<StagedFile> staged(jobs);
+
+    ClicStats* stats = indexerOptions.stats;
+    auto fail = [&](size_t i) {
+        if (runFilenames)
+            (*runFilenames)[i].clear();
+        failed = true;
+        if (stats)
+            ++stats->failedFiles;
+    };
+
+    // The prefix header of a group is built by the first worker that gets
+    // one of its files; the others wait for it.
+    size_t groupCount = files.groupOptions.size();
+    std::vector<ClicPrefixHeader> prefixes(groupCount);
+    std::unique_ptr<std::once_flag[]> prefixBuilt(new std::once_flag[groupCount]);
+    auto prefixFilename = [&](size_t group) {
+        return db.filenames().front() + ".prefix" + std::to_string(group) + ".h";
+    };
+
+    auto parser = [&]() {
+        CXIndex cxindex = clang_createIndex(0, 0);
+
+        for (size_t i = next++; i < files.size(); i = next++) {
+            const std::string& sourceFilename = files.filenames[i];
+            size_t group = files.groups[i];
+            std::vector<const char*> args = files.args(group);
+
+            if (indexerOptions.sharePrefix) {
+                std::call_once(prefixBuilt[group], [&]() {
+                    ClicPhaseTimer timer(stats, &ClicStats::prefix);
+                    buildGroupPrefix(cxindex, files, group, indexerOptions,
+                                     prefixFilename(group), prefixes[group]);
+                });
+            }
+            const ClicPrefixHeader& prefix = prefixes[group];
+            if (!prefix.pchFilename.empty()) {
+                args.push_back("-include-pch");
+                args.push_back(prefix.pchFilename.c_str());
+            }
+            args.push_back(sourceFilename.c_str());
+
+            IndexedFile item;
+            item.file = i;
+            item.index.reset(new ClicFlatIndex);
+            if (!indexTranslationUnit(cxindex, args.data(), args.size(), *item.index,
+                                      indexerOptions, onIndexed ? &item.includes : nullptr)) {
+                fail(i);
+                continue;
+            }
+            // The unit does not see into the precompiled headers
+            if (!prefix.pchFilename.empty()) {
+                appendIndex(prefix.index, *item.index);
+                item.index->finalize();
+                item.includes.insert(prefix.includes.begin(), prefix.includes.end());
+            }
+            parsed.push(std::move(item));
+        }
+        clang_disposeIndex(cxindex);
+    };
+
+    auto writer = [&]() {
+        for (IndexedFile item; parsed.pop(item); ) {
+            std::string indexFilename = indexFilenameFor(files.filenames[item.file]);
+            bool ok;
+            {
+                ClicPhaseTimer timer(stats, &ClicStats::write);
+                ok = writeIndexFile(indexFilename, *item.index);
+            }
+            if (!ok) {
+                fail(item.file);
+                continue;
+            }
+            struct stat st;
+            if (stats && stat(indexFilename.c_str(), &st) == 0)
+                stats->indexBytes += st.st_size;
+            written.push(std::move(item));
+        }
+    };
+
+    auto runWriter = [&]() {
+        for (StagedFile item; staged.pop(item); ) {
+            const std::string& runFilename = (*runFilenames)[item.file];
+            bool ok;
+            {
+                ClicPhaseTimer timer(stats, &ClicStats::commit);
+                ok = writeRun(runFilename, item.records);
+            }
+            if (!ok) {
+                remove(runFilename.c_str());
+                fail(item.file);
+            } else if (stats) {
+                ++stats->files;
+                stats->references += item.references;
+                stats->usrs += item.usrs;
+            }
+        }
+    };
+
+    std::vector<std::thread> parsers, writers, runWriters;
+    for (unsigned i = 0; i != std::min<size_t>(jobs, files.size()); ++i)
+        parsers.emplace_back(parser);
+    // Compressing and sorting take a fraction of the time parsing does
+    for (unsigned i = 0; i != (jobs + 3) / 4; ++i) {
+        writers.emplace_back(writer);
+        if (runFilenames)
+            runWriters.emplace_back(runWriter);
+    }
+    std::thread stages([&]() {
+        for (auto &t : parsers)
+            t.join();
+        parsed.close();
+        for (auto &t : writers)
+            t.join();
+        written.close();
+    });
+
+    // Only the committer uses the database. Staging hands out the ids of
+    // files and USRs, so the run writers only get its records.
+    for (IndexedFile item; written.pop(item); ) {
+        const std::string& sourceFilename = files.filenames[item.file];
+        std::vector<std::string> records;
+        {
+            ClicPhaseTimer timer(stats, &ClicStats::commit);
+            db.transaction([&]() {
+                if (runFilenames) {
+                    db.stageIndex(*item.index, sourceFilename, records);
+                } else {
+                    db.rmFile(sourceFilename);
+                    db.addIndex(*item.index, sourceFilename);
+                }
+                if (onIndexed)
+                    onIndexed(item.file, item.includes);
+            });
+        }
+
+        if (runFilenames) {
+            staged.push(StagedFile{item.file, item.index->size(), item.index->usrCount(),
+                                   std::move(records)});
+        } else if (stats) {
+            ++stats->files;
+            stats->references += item.index->size();
+            stats->usrs += item.index->usrCount();
+        }
+    }
+    staged.close();
+    for (auto &t : runWriters)
+        t.join();
+    stages.join();
+
+    if (indexerOptions.sharePrefix) {
+        for (size_t group = 0; group != groupCount; ++group) {
+            remove(prefixFilename(group).c_str());
+            remove((prefixFilename(group) + ".pch").c_str());
+        }
+    }
+    return !failed;
 }
 
-const char *prg = "";
+// Remembers what a file was indexed from, so update can tell when it has to
+// be indexed again. headerHashes caches the hashes of the headers seen.
+void recordIndexed(ClicDb& db, const std::string& sourceFilename,
+                   const ClicManifestEntry& entry,
+                   const std::set<std::string>& includes,
+                   std::map<std::string, uint64_t>& headerHashes) {
+    db.setManifest(sourceFilename, entry);
+    db.setIncludes(sourceFilename, includes);
+    for (const auto &header : includes) {
+        auto hash = headerHashes.find(header);
+        if (hash == headerHashes.end()) {
+            uint64_t value;
+            if (!hashFile(header, value))
+                continue;
+            hash = headerHashes.insert(std::make_pair(header, value)).first;
+        }
+        db.setHeaderHash(header, hash->second);
+    }
+}
 
-void usage() {
-    std::cerr << "Usage:\n"
-        << "\t" << prg << " add   <dbFilename> <indexFilename> [<options>] <sourceFilename>\n"
-        << "\t" << prg << " rm    <dbFilename> <indexFilename>\n"
-        << "\t" << prg << " clear <dbFilename>\n";
+// Removes a file from the database along with what it was indexed from
+void forgetFile(ClicDb& db, const std::string& sourceFilename) {
+    db.transaction([&]() {
+        db.rmFile(sourceFilename);
+        db.rmManifest(sourceFilename);
+        db.rmIncludes(sourceFilename);
+    });
+    remove(indexFilenameFor(sourceFilename).c_str());
 }
 
-int main_rm(int argc, const char* argv[]) {
-    if (argc != 3) {
-        usage();
-        return 1;
+// Indexes the files again whose contents or compiler options changed since
+// they were last indexed, or that are stale because a header they were
+// indexed with changed. headerHashes caches the current hashes of headers.
+bool reindexChanged(ClicDb& db, const SourceFiles& files,
+                    const std::set<std::string>& stale,
+                    std::map<std::string, uint64_t>& headerHashes,
+                    const IndexerOptions& indexerOptions, unsigned jobs) {
+    bool ok = true;
+    if (db.building()) {
+        std::cerr << "The last build did not finish, indexing all files again\n";
+        db.transaction([&]() {
+            db.clear();
+            db.setBuilding(false);
+        });
+    }
+
+    std::map<std::string, ClicManifestEntry> changed;
+    SourceFiles toIndex;
+    for (size_t i = 0; i != files.size(); ++i) {
+        const std::string& sourceFilename = files.filenames[i];
+        ClicManifestEntry entry = {0, files.flagsHash(i)};
+        if (!hashFile(sourceFilename, entry.contentHash)) {
+            std::cerr << "ERROR: Reading file `" << sourceFilename << "'.\n";
+            ok = false;
+            continue;
+        }
+
+        ClicManifestEntry stored;
+        if (db.getManifest(sourceFilename, stored) && stored == entry
+                && !stale.count(sourceFilename))
+            continue;
+        changed[sourceFilename] = entry;
+        toIndex.add(sourceFilename, files.options(i));
     }
 
-    ClicDb db(argv[2]);
+    std::cerr << "Reindexing " << toIndex.size() << " of "
+              << files.size() << " files\n";
+
+    ok &= indexFiles(db, toIndex, indexerOptions, jobs,
+            [&](size_t i, const std::set<std::string>& includes) {
+                const std::string& sourceFilename = toIndex.filenames[i];
+                recordIndexed(db, sourceFilename, changed.at(sourceFilename),
+                              includes, headerHashes);
+            });
+    return ok;
+}
 
-    igzstream in(argv[3]);
-    if (!in.good()) {
-        std::cerr << "ERROR: Opening file `" << argv[2] << "'.\n";
+int main_rm(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos != 2) {
+        usage();
         return 1;
     }
 
-    for (const auto &it : istream_range(in)) {
-        db.rmMultiple(it.first, it.second);
+    ClicDb db(argv[pos], dbOptions(options));
+    const char* sourceFilename = argv[pos + 1];
+    bool found = false;
+    db.transaction([&]() {
+        found = db.rmFile(sourceFilename);
+        db.rmManifest(sourceFilename);
+        db.rmIncludes(sourceFilename);
+    });
+    if (!found) {
+        std::cerr << "ERROR: `" << sourceFilename << "' is not indexed.\n";
+        return 1;
     }
     return 0;
 }
 
 int main_clear(int argc, const char* argv[]) {
-    if (argc != 3) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos != 1) {
         usage();
         return 1;
     }
 
-    ClicDb db(argv[2]);
+    ClicDb db(argv[pos], dbOptions(options));
     db.clear();
     return 0;
 }
 
+// Total size of the files a database consists of
+off_t databaseSize(const ClicDb& db) {
+    off_t size = 0;
+    for (const auto &filename : db.filenames()) {
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0)
+            size += st.st_size;
+    }
+    return size;
+}
+
+int main_compact(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos != 1) {
+        usage();
+        return 1;
+    }
+
+    unsigned fillPercent = numberOption(options, "fill", 90);
+    if (fillPercent < 1 || fillPercent > 100) {
+        usage();
+        return 1;
+    }
+
+    ClicDb db(argv[pos], dbOptions(options));
+    off_t before = databaseSize(db);
+    size_t freedPages = db.compact(fillPercent);
+    off_t after = databaseSize(db);
+    std::cout << "Compacted " << argv[pos] << " from " << before
+              << " to " << after << " bytes, " << freedPages
+              << " pages returned to the file system\n";
+    return 0;
+}
+
 int main_add(int argc, const char* argv[]) {
-    prg = argv[0];
-    if (argc < 5) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos < 3) {
         usage();
         return 1;
     }
 
-    const char* dbFilename = argv[2];
-    const char* indexFilename = argv[3];
-    const char* sourceFilename = argv[argc-1];
+    const char* dbFilename = argv[pos];
+    const char* indexFilename = argv[pos + 1];
+    ClicStats stats;
+    IndexerOptions indexOptions = indexerOptions(options, &stats);
 
-    // Set up the clang translation unit
+    // Set up the clang translation unit and create the index
     CXIndex cxindex = clang_createIndex(0, 0);
-    CXTranslationUnit tu = clang_parseTranslationUnit(
-        cxindex, 0,
-        argv + 2, argc - 2, // Skip over dbFilename and indexFilename
-        0, 0,
-        CXTranslationUnit_None);
-
-    // Print any errors or warnings
-    int n = clang_getNumDiagnostics(tu);
-    if (n > 0) {
-        int nErrors = 0;
-        for (int i = 0; i != n; ++i) {
-            CXDiagnostic diag = clang_getDiagnostic(tu, i);
-            CXString string = clang_formatDiagnostic(diag, clang_defaultDiagnosticDisplayOptions());
-            fprintf(stderr, "%s\n", clang_getCString(string));
-            if (clang_getDiagnosticSeverity(diag) == CXDiagnostic_Error
-                    || clang_getDiagnosticSeverity(diag) == CXDiagnostic_Fatal)
-                nErrors++;
-        }
-    }
-
-    // Create the index
-    EverythingIndexer visitor(sourceFilename);
-    clang_visitChildren(
-            clang_getTranslationUnitCursor(tu),
-            &visitorFunction,
-            &visitor);
-    ClicIndex& index = visitor.usrToReferences;
-
-    // OK, now write the index to a compressed file
-    ogzstream out(indexFilename);
-    if (!out.good()) {
-        std::cerr << "ERROR: Opening file `" << argv[2] << "'.\n";
+    ClicFlatIndex index;
+    bool parsed = indexTranslationUnit(
+        cxindex,
+        argv + pos + 2, argc - pos - 2, // Skip over dbFilename and indexFilename
+        index,
+        indexOptions);
+
+    // A file that does not parse keeps what it contributed before
+    if (!parsed) {
+        ++stats.failedFiles;
+        ClicDb db(dbFilename, dbOptions(options));
+        reportStats(options, "add", stats, db);
         return 1;
     }
-    printIndex(out, index);
 
-    // Now open the database and add the index to it
-    ClicDb db(dbFilename);
+    // Write the index to a compressed file while the database replaces
+    // what the file contributed before
+    bool written = false;
+    std::thread writer([&]() {
+        ClicPhaseTimer timer(indexOptions.stats, &ClicStats::write);
+        written = writeIndexFile(indexFilename, index);
+    });
 
-    for (const auto &it : index) {
-        const std::string& usr = it.first;
-        db.addMultiple(usr, it.second);
+    ClicDb db(dbFilename, dbOptions(options));
+    {
+        ClicPhaseTimer timer(indexOptions.stats, &ClicStats::commit);
+        db.transaction([&]() {
+            db.rmFile(argv[argc - 1]);
+            db.addIndex(index, argv[argc - 1]);
+        });
     }
 
+    writer.join();
+    struct stat st;
+    if (written && stat(indexFilename, &st) == 0)
+        stats.indexBytes += st.st_size;
+    if (written)
+        ++stats.files;
+    else
+        ++stats.failedFiles;
+    stats.references += index.size();
+    stats.usrs += index.usrCount();
+    bool reported = reportStats(options, "add", stats, db);
+    return written && reported ? 0 : 1;
+}
+
+int main_batch(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos < 2) {
+        usage();
+        return 1;
+    }
+
+    const char* dbFilename = argv[pos];
+    const char* fileListFilename = argv[pos + 1];
+    std::vector<std::string> clangOptions(argv + pos + 2, argv + argc);
+    ClicStats stats;
+
+    SourceFiles files;
+    if (!readSourceFiles(options, fileListFilename, clangOptions, files))
+        return 1;
+
+    ClicDb db(dbFilename, dbOptions(options));
+    // Record what the files were indexed from like build does, so that
+    // update does not index them again
+    std::map<std::string, uint64_t> headerHashes;
+    bool ok = indexFiles(db, files, indexerOptions(options, &stats), jobsOption(options),
+            [&](size_t i, const std::set<std::string>& includes) {
+                ClicManifestEntry entry = {0, files.flagsHash(i)};
+                if (hashFile(files.filenames[i], entry.contentHash))
+                    recordIndexed(db, files.filenames[i], entry, includes, headerHashes);
+            });
+    bool reported = reportStats(options, "batch", stats, db);
+    return ok && reported ? 0 : 1;
+}
+
+// Rebuilds the database from scratch. Every file's references go to a
+// sorted run next to the database; the runs are then merged and loaded
+// in key order, which fills the B-tree pages sequentially instead of
+// splitting them at random.
+int main_build(int argc, const char* argv[]) {
+    static const size_t maxOpenRuns = 256;
+
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos < 2) {
+        usage();
+        return 1;
+    }
+
+    const char* dbFilename = argv[pos];
+    const char* fileListFilename = argv[pos + 1];
+    std::vector<std::string> clangOptions(argv + pos + 2, argv + argc);
+    ClicStats stats;
+
+    SourceFiles files;
+    if (!readSourceFiles(options, fileListFilename, clangOptions, files))
+        return 1;
+
+    // Until the references are loaded the manifests claim more than refs
+    // holds, which update notices by the building flag
+    ClicDb db(dbFilename, dbOptions(options));
+    db.transaction([&]() {
+        db.clear();
+        db.setBuilding(true);
+    });
+
+    std::vector<std::string> runFilenames;
+    for (size_t i = 0; i != files.size(); ++i)
+        runFilenames.push_back(std::string(dbFilename) + ".run" + std::to_string(i));
+
+    std::map<std::string, uint64_t> headerHashes;
+    IndexerOptions indexOptions = indexerOptions(options, &stats);
+    bool ok = indexFiles(db, files, indexOptions, jobsOption(options),
+            [&](size_t i, const std::set<std::string>& includes) {
+                ClicManifestEntry entry = {0, files.flagsHash(i)};
+                if (hashFile(files.filenames[i], entry.contentHash))
+                    recordIndexed(db, files.filenames[i], entry, includes, headerHashes);
+            }, &runFilenames);
+
+    // A file whose run could not be written was staged all the same
+    std::vector<std::string> unloaded;
+    for (size_t i = 0; i != files.size(); ++i) {
+        if (runFilenames[i].empty())
+            unloaded.push_back(files.filenames[i]);
+    }
+    runFilenames.erase(std::remove(runFilenames.begin(), runFilenames.end(), std::string()),
+                       runFilenames.end());
+    bool loaded;
+    {
+        ClicPhaseTimer timer(indexOptions.stats, &ClicStats::load);
+        if (!reduceRuns(runFilenames, maxOpenRuns)) {
+            for (const auto &runFilename : runFilenames)
+                remove(runFilename.c_str());
+            return 1;
+        }
+        ClicRunMerger merger(runFilenames);
+        db.bulkLoad([&](std::string& record, uint32_t& copies) {
+            return merger.next(record, copies);
+        });
+        loaded = merger.good();
+    }
+    for (const auto &runFilename : runFilenames)
+        remove(runFilename.c_str());
+    if (!loaded)
+        return 1;
+
+    for (const auto &sourceFilename : unloaded) {
+        db.transaction([&]() {
+            db.unstageFile(sourceFilename);
+            db.rmManifest(sourceFilename);
+            db.rmIncludes(sourceFilename);
+        });
+    }
+    db.setBuilding(false);
+    ok &= reportStats(options, "build", stats, db);
+    return ok ? 0 : 1;
+}
+
+int main_update(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos < 2) {
+        usage();
+        return 1;
+    }
+
+    const char* dbFilename = argv[pos];
+    const char* fileListFilename = argv[pos + 1];
+    std::vector<std::string> clangOptions(argv + pos + 2, argv + argc);
+    ClicStats stats;
+
+    SourceFiles files;
+    if (!readSourceFiles(options, fileListFilename, clangOptions, files))
+        return 1;
+
+    ClicDb db(dbFilename, dbOptions(options));
+
+    // Drop the files that are no longer part of the project
+    std::set<std::string> current(files.filenames.begin(), files.filenames.end());
+    for (const auto &sourceFilename : db.manifestFiles()) {
+        if (!current.count(sourceFilename))
+            forgetFile(db, sourceFilename);
+    }
+
+    // A modified header invalidates every file that was indexed with it.
+    // The include graph stores all headers a file saw, so this covers
+    // indirect inclusion as well.
+    std::set<std::string> stale;
+    std::map<std::string, uint64_t> headerHashes;
+    for (const auto &it : db.headerHashes()) {
+        uint64_t hash = 0;
+        bool readable = hashFile(it.first, hash);
+        if (readable)
+            headerHashes[it.first] = hash;
+        if (!readable || hash != it.second)
+            for (const auto &includer : db.includers(it.first))
+                stale.insert(includer);
+    }
+
+    bool ok = reindexChanged(db, files, stale, headerHashes,
+                             indexerOptions(options, &stats), jobsOption(options));
+    bool reported = reportStats(options, "update", stats, db);
+    return ok && reported ? 0 : 1;
+}
+
+// The files clang4vim-index.sh indexes
+bool isSourceFile(const std::string& filename) {
+    static const char* const extensions[] = {".cpp", ".hpp", ".cxx", ".hxx", ".cc", ".c", ".h"};
+    std::string::size_type dot = filename.rfind('.');
+    if (dot == std::string::npos || filename.find('/', dot) != std::string::npos)
+        return false;
+    for (const char* extension : extensions)
+        if (filename.compare(dot, std::string::npos, extension) == 0)
+            return true;
+    return false;
+}
+
+// Keeps a database built by build or update current while files change,
+// doing work in proportion to the changes instead of the project size.
+int main_watch(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    // Other processes use the database while watch runs
+    if (argc - pos < 2 || !options.count("txn")
+            || (options.count("compdb") && options["compdb"].empty())) {
+        usage();
+        return 1;
+    }
+
+    const char* dbFilename = argv[pos];
+    const char* directory = argv[pos + 1];
+    std::vector<std::string> clangOptions(argv + pos + 2, argv + argc);
+    unsigned debounceMs = numberOption(options, "debounce", 500);
+
+    ClicWatcher watcher;
+    if (!watcher.watch(directory))
+        return 1;
+
+    ClicDb db(dbFilename, dbOptions(options));
+
+    // With --compdb only the files it lists are indexed, each with its own
+    // options. Every batch of changes first reads it again if it changed,
+    // and then reindexes the files whose options changed.
+    std::string compdbFilename = options.count("compdb") ? options["compdb"] : "";
+    SourceFiles project;
+    std::map<std::string, size_t> projectFiles;
+    struct timespec compdbTime = {0, 0};
+    auto readProject = [&](bool& changed) {
+        changed = false;
+        struct stat st;
+        if (stat(compdbFilename.c_str(), &st) != 0) {
+            std::cerr << "ERROR: Opening file `" << compdbFilename << "'.\n";
+            return false;
+        }
+        if (st.st_mtim.tv_sec == compdbTime.tv_sec && st.st_mtim.tv_nsec == compdbTime.tv_nsec)
+            return true;
+
+        SourceFiles current;
+        if (!readSourceFiles(options, compdbFilename.c_str(), clangOptions, current))
+            return false;
+        compdbTime = st.st_mtim;
+        project = current;
+        projectFiles.clear();
+        for (size_t i = 0; i != project.size(); ++i)
+            projectFiles[project.filenames[i]] = i;
+        changed = true;
+        return true;
+    };
+    bool projectChanged;
+    if (!compdbFilename.empty() && !readProject(projectChanged))
+        return 1;
+
+    std::set<std::string> modified, removed;
+    bool overflowed;
+    ClicWatcher::Result result;
+    while ((result = watcher.wait(debounceMs, modified, removed, overflowed))
+            == ClicWatcher::Changed) {
+        if (overflowed) {
+            // Events were lost, so compare everything like update does
+            std::cerr << "Too many changes, checking all files\n";
+            modified.clear();
+            removed.clear();
+            watcher.listFiles(modified);
+            for (const auto &sourceFilename : db.manifestFiles())
+                if (!modified.count(sourceFilename))
+                    removed.insert(sourceFilename);
+        }
+
+        SourceFiles files;
+        if (!compdbFilename.empty() && readProject(projectChanged) && projectChanged) {
+            // Like update: drop the files no longer listed and let
+            // reindexChanged find those whose options changed
+            for (const auto &sourceFilename : db.manifestFiles())
+                if (!projectFiles.count(sourceFilename))
+                    forgetFile(db, sourceFilename);
+            for (size_t i = 0; i != project.size(); ++i)
+                files.add(project.filenames[i], project.options(i));
+        }
+        auto isRemoved = [&](const std::string& path) {
+            if (removed.count(path))
+                return true;
+            for (const auto &dir : removed)
+                if (dir[dir.size() - 1] == '/' && path.compare(0, dir.size(), dir) == 0)
+                    return true;
+            return false;
+        };
+        auto addFile = [&](const std::string& sourceFilename) {
+            if (compdbFilename.empty()) {
+                files.add(sourceFilename, clangOptions);
+                return;
+            }
+            auto it = projectFiles.find(sourceFilename);
+            if (it != projectFiles.end())
+                files.add(sourceFilename, project.options(it->second));
+        };
+
+        std::set<std::string> stale;
+        auto checkHeader = [&](const std::string& header) {
+            uint64_t stored, hash;
+            if (!db.headerHash(header, stored)
+                    || (hashFile(header, hash) && hash == stored))
+                return;
+            for (const auto &includer : db.includers(header)) {
+                stale.insert(includer);
+                if (!isRemoved(includer))
+                    addFile(includer);
+            }
+        };
+
+        for (const auto &path : removed) {
+            if (path[path.size() - 1] == '/') {
+                for (const auto &sourceFilename : db.manifestFiles())
+                    if (sourceFilename.compare(0, path.size(), path) == 0)
+                        forgetFile(db, sourceFilename);
+                // The files outside that included headers from there
+                for (const auto &header : db.headersWithPrefix(path))
+                    checkHeader(header);
+            } else {
+                if (isSourceFile(path))
+                    forgetFile(db, path);
+                checkHeader(path);
+            }
+        }
+        for (const auto &path : modified) {
+            if (isSourceFile(path))
+                addFile(path);
+            checkHeader(path);
+        }
+
+        if (files.size()) {
+            std::map<std::string, uint64_t> headerHashes;
+            reindexChanged(db, files, stale, headerHashes,
+                           indexerOptions(options), jobsOption(options));
+        }
+    }
+    return result == ClicWatcher::Stopped ? 0 : 1;
+}
+
+int querySnapshot(const char* snapshotFilename, const char* usrs[], int count, bool prefix) {
+    ClicSnapshot snapshot;
+    if (!snapshot.open(snapshotFilename))
+        return 1;
+
+    ClicLocation loc;
+    for (int i = 0; i != count; ++i) {
+        StringRef key(usrs[i], strlen(usrs[i]));
+        size_t first = snapshot.find(key);
+        size_t last = first + 1;
+        if (prefix)
+            snapshot.findPrefix(key, first, last);
+        else if (first == ClicSnapshot::npos)
+            continue;
+
+        for (size_t j = first; j != last; ++j) {
+            StringRef usr = snapshot.usr(j);
+            for (ClicSnapshot::LocationReader reader = snapshot.locations(j); reader.next(loc); ) {
+                if (prefix)
+                    std::cout.write(usr.data, usr.size) << '\t';
+                std::cout << formatLocation(snapshot.file(loc.file).str(),
+                                            loc.line, loc.column, loc.kind) << '\n';
+            }
+        }
+    }
+    return 0;
+}
+
+int main_query(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos < 2) {
+        usage();
+        return 1;
+    }
+
+    if (options.count("snapshot"))
+        return querySnapshot(argv[pos], argv + pos + 1, argc - pos - 1,
+                             options.count("prefix") != 0);
+
+    ClicDb db(argv[pos], dbOptions(options));
+    for (int i = pos + 1; i != argc; ++i) {
+        if (options.count("prefix")) {
+            db.forEachLocationWithPrefix(argv[i],
+                    [](const std::string& usr, const std::string& location) {
+                        std::cout << usr << '\t' << location << '\n';
+                    });
+        } else {
+            db.forEachLocation(argv[i],
+                    [](const std::string&, const std::string& location) {
+                        std::cout << location << '\n';
+                    });
+        }
+    }
     return 0;
 }
 
+// Prints the entities whose names start with, or contain, the given names
+int main_names(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos < 2) {
+        usage();
+        return 1;
+    }
+
+    ClicDb db(argv[pos], dbOptions(options));
+    for (int i = pos + 1; i != argc; ++i) {
+        db.findNames(argv[i], options.count("substring") != 0,
+                [](const std::string& name, const std::string& usr, uint32_t kind) {
+                    std::cout << name << '\t' << cursorKindSpelling(kind) << '\t' << usr << '\n';
+                });
+    }
+    return 0;
+}
+
+int main_export_snapshot(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    if (argc - pos != 2) {
+        usage();
+        return 1;
+    }
+
+    ClicDb db(argv[pos], dbOptions(options));
+    return writeSnapshot(argv[pos + 1], db) ? 0 : 1;
+}
+
+int main_daemon(int argc, const char* argv[]) {
+    int pos = 2;
+    std::map<std::string, std::string> options = parseOptions(argc, argv, pos);
+    // Other processes use the database while the daemon runs
+    if (argc - pos != 2 || !options.count("txn")) {
+        usage();
+        return 1;
+    }
+
+    ClicDaemon daemon(argv[pos], dbOptions(options), indexerOptions(options));
+    return daemon.run(argv[pos + 1]);
+}
+
 int main(int argc, const char* argv[]) {
     prg = argv[0];
 
@@ -185,9 +1121,36 @@ int main(int argc, const char* argv[]) {
     if (std::string("add") == cmd)
         return main_add(argc, argv);
 
+    if (std::string("batch") == cmd)
+        return main_batch(argc, argv);
+
+    if (std::string("build") == cmd)
+        return main_build(argc, argv);
+
+    if (std::string("update") == cmd)
+        return main_update(argc, argv);
+
+    if (std::string("watch") == cmd)
+        return main_watch(argc, argv);
+
     if (std::string("rm") == cmd)
         return main_rm(argc, argv);
 
+    if (std::string("query") == cmd)
+        return main_query(argc, argv);
+
+    if (std::string("daemon") == cmd)
+        return main_daemon(argc, argv);
+
+    if (std::string("names") == cmd)
+        return main_names(argc, argv);
+
+    if (std::string("export-snapshot") == cmd)
+        return main_export_snapshot(argc, argv);
+
+    if (std::string("compact") == cmd)
+        return main_compact(argc, argv);
+
     if (std::string("clear") == cmd)
         return main_clear(argc, argv);
 
@@ -0,0 +1,82 @@
+#!/bin/bash
+# Checks that a reference several source files contribute stays in the
+# database until the last of them is removed, whether the files were added
+# one by one, built in bulk or reindexed by update.
+#
+# Settings, from the environment:
+#   TEST_DIR  scratch directory  (/tmp/clic-test)
+#   CLIC      the binary to test (../clang4vim-index)
+
+WORK=${TEST_DIR:-/tmp/clic-test}
+
+HERE=`cd $(dirname $0); pwd`
+CLIC=${CLIC:-$HERE/../clang4vim-index}
+CLIC=`cd $(dirname $CLIC); pwd`/`basename $CLIC`
+
+if [ ! -x $CLIC ]; then
+    echo "ERROR: No clang4vim-index at \`$CLIC'." >&2
+    exit 1
+fi
+
+FAILED=0
+
+# Runs a command in the database directory, the check stops if it fails
+run() {
+    "$@" > log 2>&1 || { cat log >&2; echo "ERROR: $* failed." >&2; exit 1; }
+}
+
+# Expects the call of shared() in the header to be in the database or not
+expect() {
+    local found=no
+    $CLIC query --prefix index.db 'c:@F@shared' | grep -q "/shared.h:2:" && found=yes
+    if [ $found != $1 ]; then
+        echo "FAIL $2: shared reference found=$found, expected $1"
+        FAILED=1
+    else
+        echo "ok   $2"
+    fi
+}
+
+# Both source files see the reference in the header they include
+project() {
+    rm -rf $WORK
+    mkdir -p $WORK
+    cd $WORK
+    cat > shared.h <<'END'
+inline int shared() { return 0; }
+inline int caller() { return shared(); }
+END
+    for f in a b; do
+        printf '#include "shared.h"\nint %s() { return caller(); }\n' $f > $f.cpp
+    done
+    printf '%s\n' $WORK/a.cpp $WORK/b.cpp > files.txt
+}
+
+project
+run $CLIC add index.db a.i.gz $WORK/a.cpp
+run $CLIC add index.db b.i.gz $WORK/b.cpp
+expect yes "add: both files"
+run $CLIC rm index.db $WORK/a.cpp
+expect yes "add: rm one file"
+run $CLIC rm index.db $WORK/b.cpp
+expect no "add: rm both files"
+
+project
+run $CLIC build index.db files.txt
+expect yes "build: both files"
+run $CLIC rm index.db $WORK/a.cpp
+expect yes "build: rm one file"
+run $CLIC rm index.db $WORK/b.cpp
+expect no "build: rm both files"
+
+# Reindexing a file must neither drop nor double the reference
+project
+run $CLIC build index.db files.txt
+echo "int modified;" >> a.cpp
+run $CLIC update index.db files.txt
+run $CLIC rm index.db $WORK/a.cpp
+expect yes "update: rm one file"
+run $CLIC rm index.db $WORK/b.cpp
+expect no "update: rm both files"
+
+exit $FAILED
@@ -1,15 +1,41 @@
 #pragma once
 
+#include <cstring>
 #include <string>
 #include <list>
 #include <map>
 #include <set>
 
-typedef std::map<std::string, std::set<std::string>> ClicIndex;
-typedef std::pair<std::string, std::set<std::string>> ClicIndexItem;
+// A non-owning view of bytes owned by someone else.
+struct StringRef {
+    const char* data;
+    size_t size;
+
+    StringRef() : data(""), size(0) {}
+    StringRef(const char* data, size_t size) : data(data), size(size) {}
+    StringRef(const std::string& str) : data(str.data()), size(str.size()) {}
+
+    std::string str() const { return std::string(data, size); }
+    bool empty() const { return size == 0; }
+
+    int compare(const StringRef& rhs) const {
+        int res = memcmp(data, rhs.data, size < rhs.size ? size : rhs.size);
+        if (res != 0)
+            return res;
+        return size < rhs.size ? -1 : size > rhs.size ? 1 : 0;
+    }
+    bool operator==(const StringRef& rhs) const {
+        return size == rhs.size && memcmp(data, rhs.data, size) == 0;
+    }
+    bool operator!=(const StringRef& rhs) const { return !(*this == rhs); }
+    bool operator<(const StringRef& rhs) const { return compare(rhs) < 0; }
+};
 
 inline std::list<std::string> split(const std::string& str, int delim = ' '){
     std::list<std::string> res;
+    if (str.empty())
+        return res;
+
     std::string::size_type i = 0;
     std::string::size_type j = str.find(delim);
 
@@ -17,10 +43,8 @@ inline std::list<std::string> split(const std::string& str, int delim = ' '){
         res.push_back(str.substr(i, j-i));
         i = ++j;
         j = str.find(delim, j);
-
-        if (j == std::string::npos)
-            res.push_back(str.substr(i, str.length()));
     }
+    res.push_back(str.substr(i));
 
     return res;
 }